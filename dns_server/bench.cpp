@@ -0,0 +1,450 @@
+#include "dns_zone.hpp"
+#include "dns_wire.hpp"
+#include "../src/dns.hpp"
+#include "../src/dns_view.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <arpa/inet.h>
+
+// how long each benchmark runs, in rounds
+#define BENCH_ROUND_MS  100
+#define BENCH_ROUNDS      5
+// names in the zone the lookup benchmark answers from
+#define BENCH_ZONE_NAMES  100000
+// queries it cycles through, about one in ten for a name not in the zone
+#define BENCH_QUERIES     1024
+
+using namespace std;
+
+// results go here, so the compiler can't leave the work out
+static volatile uint64_t sink;
+
+static uint64_t now_ns()
+{
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(
+      steady_clock::now().time_since_epoch()).count();
+}
+
+// call op(i) for i = 0, 1, 2 ... in rounds of about BENCH_ROUND_MS,
+// returns the nanoseconds per call of the median round
+template <typename Op>
+static double measure(Op op)
+{
+  // find how many calls make a round, warming up on the way
+  uint64_t calls = 64;
+  while (true)
+  {
+    uint64_t start = now_ns();
+    for (uint64_t i = 0; i < calls; i++) op(i);
+    if (now_ns() - start >= BENCH_ROUND_MS * 1000000ull / 4) break;
+    calls *= 2;
+  }
+  calls *= 4;
+  
+  double rounds[BENCH_ROUNDS];
+  for (int r = 0; r < BENCH_ROUNDS; r++)
+  {
+    uint64_t start = now_ns();
+    for (uint64_t i = 0; i < calls; i++) op(i);
+    rounds[r] = (double) (now_ns() - start) / calls;
+  }
+  sort(rounds, rounds + BENCH_ROUNDS);
+  return rounds[BENCH_ROUNDS / 2];
+}
+
+static void report(const string& name, double ns)
+{
+  cout << left << setw(36) << name << right
+       << setw(10) << fixed << setprecision(1) << ns << " ns/op"
+       << setw(12) << setprecision(2) << 1000.0 / ns << " Mop/s" << endl;
+}
+
+/**
+ * Puts together the responses the benchmarks parse, with names
+ * compressed the way servers compress them
+**/
+class CorpusPacket
+{
+public:
+  CorpusPacket(const char* qname, uint16_t qtype, int rcode = NO_ERROR)
+    : names(packet, sizeof(packet))
+  {
+    DnsRequestBuilder builder(packet, sizeof(packet), 0x1234);
+    builder.addQuestion(qname, qtype);
+    pos = builder.length();
+    names.remember(sizeof(dns_header_t));
+    
+    dns_header_t& hdr = *(dns_header_t*) packet;
+    hdr.qr = DNS_QR_RESPONSE;
+    hdr.ra = 1;
+    hdr.rcode = rcode;
+  }
+  
+  // a record with rdata as it is
+  void add(dns_section_t section, const char* owner, uint16_t type,
+           const void* rdata, int rdlength, uint32_t ttl = 300)
+  {
+    int len = start(section, owner, type, ttl);
+    memcpy(packet + pos, rdata, rdlength);
+    pos += rdlength;
+    put16(packet + len, rdlength);
+  }
+  // a record that is a name, after prefix bytes of rdata (MX, SRV)
+  void addName(dns_section_t section, const char* owner, uint16_t type,
+               const char* target, const void* prefix = nullptr, int prefixlen = 0)
+  {
+    int len = start(section, owner, type, 300);
+    int rdata = pos;
+    if (prefixlen) memcpy(packet + pos, prefix, prefixlen);
+    pos += prefixlen;
+    
+    DnsName name;
+    name.parse(target);
+    pos += names.write(pos, name, sizeof(packet) - pos);
+    put16(packet + len, pos - rdata);
+  }
+  // an OPT record, advertising payload
+  void addEDNS(uint16_t payload)
+  {
+    char opt[11] = { 0 };
+    put16(opt + 1, DNS_TYPE_OPT);
+    put16(opt + 3, payload);
+    memcpy(packet + pos, opt, sizeof(opt));
+    pos += sizeof(opt);
+    count(DNS_ADDITIONAL);
+  }
+  
+  string str() const
+  {
+    return string(packet, pos);
+  }
+
+private:
+  // the owner and fixed part of a record, returns where its rdlength goes
+  int start(dns_section_t section, const char* owner, uint16_t type, uint32_t ttl)
+  {
+    DnsName name;
+    name.parse(owner);
+    pos += names.write(pos, name, sizeof(packet) - pos);
+    
+    put16(packet + pos, type);
+    put16(packet + pos + 2, DNS_CLASS_INET);
+    uint32_t nttl = htonl(ttl);
+    memcpy(packet + pos + 4, &nttl, 4);
+    pos += 10;
+    count(section);
+    return pos - 2;
+  }
+  void count(dns_section_t section)
+  {
+    // the counts follow the question count in the header
+    char* counts = packet + 6 + section * 2;
+    put16(counts, get16(counts) + 1);
+  }
+  
+  char packet[4096];
+  int  pos;
+  DnsNameEncoder names;
+};
+
+// responses like the ones resolvers see the most of
+static vector<string> builtinCorpus()
+{
+  vector<string> corpus;
+  
+  {
+    // a name with a handful of addresses
+    CorpusPacket p("www.google.com", DNS_TYPE_A);
+    for (int i = 0; i < 8; i++)
+    {
+      uint8_t addr[4] = { 213, 155, 151, (uint8_t) (180 + i) };
+      p.add(DNS_ANSWER, "www.google.com", DNS_TYPE_A, addr, 4);
+    }
+    p.addEDNS(1232);
+    corpus.push_back(p.str());
+  }
+  {
+    // through a CDN, by way of aliases
+    CorpusPacket p("www.github.com", DNS_TYPE_A);
+    p.addName(DNS_ANSWER, "www.github.com", DNS_TYPE_CNAME, "github.com");
+    p.addName(DNS_ANSWER, "github.com", DNS_TYPE_CNAME, "github.map.fastly.net");
+    uint8_t addr[4] = { 140, 82, 121, 4 };
+    p.add(DNS_ANSWER, "github.map.fastly.net", DNS_TYPE_A, addr, 4);
+    corpus.push_back(p.str());
+  }
+  {
+    CorpusPacket p("www.facebook.com", DNS_TYPE_AAAA);
+    p.addName(DNS_ANSWER, "www.facebook.com", DNS_TYPE_CNAME, "star-mini.c10r.facebook.com");
+    uint8_t addr[16] = { 0x2a, 0x03, 0x28, 0x80, 0xf1, 0x2f, 0x00, 0x83,
+                         0xfa, 0xce, 0xb0, 0x0c, 0x00, 0x00, 0x25, 0xde };
+    p.add(DNS_ANSWER, "star-mini.c10r.facebook.com", DNS_TYPE_AAAA, addr, 16);
+    corpus.push_back(p.str());
+  }
+  {
+    CorpusPacket p("gmail.com", DNS_TYPE_MX);
+    const char* exchanges[] = { "gmail-smtp-in.l.google.com", "alt1.gmail-smtp-in.l.google.com",
+                                "alt2.gmail-smtp-in.l.google.com", "alt3.gmail-smtp-in.l.google.com",
+                                "alt4.gmail-smtp-in.l.google.com" };
+    for (int i = 0; i < 5; i++)
+    {
+      char pref[2];
+      put16(pref, 5 + i * 5);
+      p.addName(DNS_ANSWER, "gmail.com", DNS_TYPE_MX, exchanges[i], pref, 2);
+    }
+    corpus.push_back(p.str());
+  }
+  {
+    CorpusPacket p("example.com", DNS_TYPE_TXT);
+    const char spf[] = "v=spf1 ip4:192.0.2.0/24 ip4:198.51.100.0/24 include:_spf.example.net ~all";
+    char txt[sizeof(spf)];
+    txt[0] = sizeof(spf) - 1;
+    memcpy(txt + 1, spf, sizeof(spf) - 1);
+    p.add(DNS_ANSWER, "example.com", DNS_TYPE_TXT, txt, sizeof(spf));
+    corpus.push_back(p.str());
+  }
+  {
+    // a name that doesn't exist, with the SOA to cache that for
+    CorpusPacket p("nope.example.com", DNS_TYPE_A, NAME_ERROR);
+    char rdata[64];
+    int n = DnsRequestBuilder::encodeName("ns.icann.org", rdata, sizeof(rdata));
+    n += DnsRequestBuilder::encodeName("noc.dns.icann.org", rdata + n, sizeof(rdata) - n);
+    uint32_t fields[5] = { htonl(2024010101), htonl(7200), htonl(3600), htonl(1209600), htonl(3600) };
+    memcpy(rdata + n, fields, sizeof(fields));
+    p.add(DNS_AUTHORITY, "example.com", DNS_TYPE_SOA, rdata, n + sizeof(fields), 3600);
+    corpus.push_back(p.str());
+  }
+  {
+    // a referral from the root, with glue
+    CorpusPacket p("www.example.com", DNS_TYPE_A);
+    char server[32];
+    for (int i = 0; i < 13; i++)
+    {
+      snprintf(server, sizeof(server), "%c.gtld-servers.net", 'a' + i);
+      p.addName(DNS_AUTHORITY, "com", DNS_TYPE_NS, server);
+    }
+    for (int i = 0; i < 13; i++)
+    {
+      snprintf(server, sizeof(server), "%c.gtld-servers.net", 'a' + i);
+      uint8_t addr[4] = { 192, 5, 6, (uint8_t) (30 + i) };
+      p.add(DNS_ADDITIONAL, server, DNS_TYPE_A, addr, 4, 172800);
+    }
+    p.addEDNS(1232);
+    corpus.push_back(p.str());
+  }
+  return corpus;
+}
+
+// responses as they came off the wire, each with its two byte
+// length in front (as over TCP), returns false if it can't be read
+static bool readCorpus(const string& path, vector<string>& corpus)
+{
+  ifstream file(path, ios::binary);
+  if (!file) return false;
+  
+  unsigned char len[2];
+  while (file.read((char*) len, 2))
+  {
+    string packet(len[0] << 8 | len[1], '\0');
+    if (!file.read(&packet[0], packet.size())) return false;
+    corpus.push_back(packet);
+  }
+  return !corpus.empty();
+}
+
+static string hostname(int i)
+{
+  ostringstream name;
+  name << "host" << i << ".bench.example.";
+  return name.str();
+}
+
+// dns_bench [corpus of recorded responses]
+// times the hot paths of the client and the server, one at a time
+int main(int argc, char** argv)
+{
+  vector<string> corpus;
+  if (argc > 1)
+  {
+    if (!readCorpus(argv[1], corpus))
+    {
+      cerr << argv[1] << ": not a corpus of responses" << endl;
+      return 1;
+    }
+  }
+  else corpus = builtinCorpus();
+  
+  // only what parses, the rest would measure error handling
+  vector<string> valid;
+  for (auto& packet : corpus)
+  {
+    DnsView view;
+    if (view.parse(packet.data(), packet.size())) valid.push_back(packet);
+  }
+  if (valid.empty())
+  {
+    cerr << "No valid responses in the corpus" << endl;
+    return 1;
+  }
+  cout << "Corpus of " << valid.size() << " responses" << endl;
+  
+  // every name in them: owners, and rdata that is a name
+  vector<pair<int, int>> names; // which packet, and where
+  for (int i = 0; i < (int) valid.size(); i++)
+  {
+    DnsView view;
+    view.parse(valid[i].data(), valid[i].size());
+    names.emplace_back(i, view.qname());
+    
+    for (int s = DNS_ANSWER; s <= DNS_ADDITIONAL; s++)
+    {
+      const dns_rr_view_t* rrs = view.records((dns_section_t) s);
+      for (int r = 0; r < view.count((dns_section_t) s); r++)
+      {
+        names.emplace_back(i, rrs[r].name);
+        if (rrs[r].type == DNS_TYPE_CNAME || rrs[r].type == DNS_TYPE_NS)
+          names.emplace_back(i, rrs[r].rdata);
+      }
+    }
+  }
+  
+  // the client
+  {
+    vector<string> hosts;
+    for (int i = 0; i < 64; i++) hosts.push_back(hostname(i));
+    
+    DnsRequest req;
+    char query[DNS_REQUEST_MAX];
+    report("DnsRequest::createRequest", measure([&] (uint64_t i)
+    {
+      sink += req.createRequest(query, hosts[i % hosts.size()], DNS_TYPE_A,
+                                DNS_CLASS_INET, DNS_FLAG_RD, DNS_EDNS_PAYLOAD);
+    }));
+  }
+  {
+    DnsRequest req;
+    report("DnsRequest::parseResponse", measure([&] (uint64_t i)
+    {
+      string& packet = valid[i % valid.size()];
+      sink += req.parseResponse(&packet[0], packet.size());
+    }));
+  }
+  {
+    DnsView view;
+    report("DnsView::parse", measure([&] (uint64_t i)
+    {
+      string& packet = valid[i % valid.size()];
+      sink += view.parse(packet.data(), packet.size());
+    }));
+  }
+  {
+    char out[DNS_NAME_MAX];
+    report("DnsView::readName", measure([&] (uint64_t i)
+    {
+      auto& name = names[i % names.size()];
+      const string& packet = valid[name.first];
+      sink += DnsView::readName(packet.data(), packet.size(), name.second, out, sizeof(out));
+    }));
+  }
+  {
+    DnsName name;
+    report("DnsName::read", measure([&] (uint64_t i)
+    {
+      auto& where = names[i % names.size()];
+      const string& packet = valid[where.first];
+      sink += name.read(packet.data(), packet.size(), where.second);
+    }));
+  }
+  
+  // the server
+  DNS_zone zone;
+  for (int i = 0; i < BENCH_ZONE_NAMES; i++)
+  {
+    DNS_zone::addr_list addrs;
+    for (int a = 0; a <= i % 4; a++)
+      addrs.push_back(DNS_zone::ip4(10, i >> 16 & 0xff, i >> 8 & 0xff, i & 0xff));
+    zone.addMapping(hostname(i), addrs);
+  }
+  // and a few wildcards in place of many more names
+  zone.addMapping("*.wild.bench.example.", DNS_zone::addr_list(1, DNS_zone::ip4(10, 255, 0, 1)));
+  
+  DNS_index::soa_t soa;
+  soa.apex  = "bench.example.";
+  soa.mname = "ns1.bench.example.";
+  soa.rname = "hostmaster.bench.example.";
+  soa.serial = 1;
+  soa.refresh = 7200;
+  soa.retry   = 1800;
+  soa.expire  = 1209600;
+  soa.minimum = 300;
+  soa.ttl     = 3600;
+  zone.setSOA(soa);
+  zone.build();
+  
+  // all of them, those in the zone, and those not in it
+  vector<string> queries, hits, misses, wild;
+  for (int i = 0; i < BENCH_QUERIES * 2; i++)
+  {
+    bool hit = i % 2 == 0;
+    // some in capitals, the way some resolvers randomise case
+    string host = hit ? hostname((i * 7919) % BENCH_ZONE_NAMES)
+                      : hostname(BENCH_ZONE_NAMES + i);
+    if (i % 3 == 0) transform(host.begin(), host.begin() + 4, host.begin(), ::toupper);
+    
+    char query[DNS_REQUEST_MAX];
+    DnsRequestBuilder builder(query, sizeof(query), i);
+    builder.addQuestion(host.c_str(), DNS_TYPE_A);
+    string packet(query, builder.length());
+    
+    (hit ? hits : misses).push_back(packet);
+    if (hit || i % 20 == 1) queries.push_back(packet);
+    
+    string any = "n" + to_string(i) + ".wild.bench.example.";
+    DnsRequestBuilder wildcard(query, sizeof(query), i);
+    wildcard.addQuestion(any.c_str(), DNS_TYPE_A);
+    wild.push_back(string(query, wildcard.length()));
+  }
+  {
+    char buffer[DNS_UDP_MAX];
+    report("DNS_zone::createResponse", measure([&] (uint64_t i)
+    {
+      const string& query = queries[i % queries.size()];
+      memcpy(buffer, query.data(), query.size());
+      sink += zone.createResponse(buffer, query.size(), sizeof(buffer));
+    }));
+    report("DNS_zone::createResponse (hits)", measure([&] (uint64_t i)
+    {
+      const string& query = hits[i % hits.size()];
+      memcpy(buffer, query.data(), query.size());
+      sink += zone.createResponse(buffer, query.size(), sizeof(buffer));
+    }));
+    report("DNS_zone::createResponse (misses)", measure([&] (uint64_t i)
+    {
+      const string& query = misses[i % misses.size()];
+      memcpy(buffer, query.data(), query.size());
+      sink += zone.createResponse(buffer, query.size(), sizeof(buffer));
+    }));
+    report("DNS_zone::createResponse (wildcard)", measure([&] (uint64_t i)
+    {
+      const string& query = wild[i % wild.size()];
+      memcpy(buffer, query.data(), query.size());
+      sink += zone.createResponse(buffer, query.size(), sizeof(buffer));
+    }));
+  }
+  {
+    report("DNS_zone::contains", measure([&] (uint64_t i)
+    {
+      const string& query = queries[i % queries.size()];
+      sink += zone.contains(query.data(), query.size());
+    }));
+  }
+  return 0;
+}
@@ -0,0 +1,108 @@
+#include "dns_exporter.hpp"
+#include "../src/dns_metrics.hpp"
+
+#include <errno.h>
+#include <iostream>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace std;
+
+bool DNS_exporter::start(uint16_t port)
+{
+  sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+  if (sock < 0)
+  {
+    cout << "<DNS EXPORTER> socket: " << strerror(errno) << endl;
+    return false;
+  }
+  int on = 1;
+  setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port   = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  
+  if (bind(sock, (sockaddr*) &addr, sizeof(addr)) < 0 || listen(sock, 16) < 0)
+  {
+    cout << "<DNS EXPORTER> bind: " << strerror(errno) << endl;
+    close(sock);
+    sock = -1;
+    return false;
+  }
+  running = true;
+  thread = std::thread([this] { run(); });
+  return true;
+}
+
+void DNS_exporter::stop()
+{
+  running = false;
+  if (thread.joinable()) thread.join();
+  if (sock >= 0) close(sock);
+  sock = -1;
+}
+
+void DNS_exporter::run()
+{
+  while (running)
+  {
+    pollfd pfd = { sock, POLLIN, 0 };
+    if (poll(&pfd, 1, DNS_EXPORT_POLL_MS) <= 0) continue;
+    
+    int client = accept4(sock, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client < 0) continue;
+    serve(client);
+    close(client);
+  }
+}
+
+void DNS_exporter::serve(int client)
+{
+  // a scraper that never finishes its request doesn't hold us up
+  timeval tv;
+  tv.tv_sec  = DNS_EXPORT_TIMEOUT_MS / 1000;
+  tv.tv_usec = (DNS_EXPORT_TIMEOUT_MS % 1000) * 1000;
+  setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  
+  // the request line and headers, of which only the first line matters
+  string request;
+  char buffer[1024];
+  while (request.find("\r\n\r\n") == string::npos && request.size() < DNS_EXPORT_REQUEST_MAX)
+  {
+    int len = recv(client, buffer, sizeof(buffer), 0);
+    if (len <= 0) break;
+    request.append(buffer, len);
+  }
+  
+  string status = "200 OK";
+  string body;
+  if (request.compare(0, 4, "GET ") != 0)
+    status = "405 Method Not Allowed";
+  else if (request.compare(4, 9, "/metrics ") != 0 && request.compare(4, 9, "/metrics?") != 0)
+    status = "404 Not Found";
+  else
+    body = DnsMetrics::prometheus();
+  
+  string response = "HTTP/1.0 " + status + "\r\n"
+    "Content-Type: text/plain; version=0.0.4\r\n"
+    "Content-Length: " + to_string(body.size()) + "\r\n"
+    "Connection: close\r\n\r\n" + body;
+  
+  size_t sent = 0;
+  while (sent < response.size())
+  {
+    int res = ::send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+    if (res < 0 && errno == EINTR) continue;
+    if (res <= 0) return;
+    sent += res;
+  }
+}
@@ -0,0 +1,47 @@
+#ifndef DNS_EXPORTER_HPP
+#define DNS_EXPORTER_HPP
+
+#include <stdint.h>
+
+#include <atomic>
+#include <thread>
+
+// how often an idle exporter checks if it should stop
+#define DNS_EXPORT_POLL_MS      250
+// how long a scraper has to send its request
+#define DNS_EXPORT_TIMEOUT_MS  1000
+// largest request we read, the rest is ignored
+#define DNS_EXPORT_REQUEST_MAX 4096
+
+/**
+ * Serves the metrics of everything in this process (see DnsMetrics)
+ * to Prometheus, as text over HTTP at /metrics
+ *
+ * Scrapes are rare and small, so a thread of its own takes them one
+ * at a time, and adding up the metrics for each is all the contact
+ * it ever has with the workers.
+**/
+class DNS_exporter
+{
+public:
+  DNS_exporter() : sock(-1), running(false) {}
+  ~DNS_exporter()
+  {
+    stop();
+  }
+  
+  // listen on port on all interfaces, returns false if we can't
+  bool start(uint16_t port);
+  void stop();
+
+private:
+  void run();
+  // answer one scrape on the connection client
+  void serve(int client);
+  
+  int sock;
+  std::thread thread;
+  std::atomic<bool> running;
+};
+
+#endif
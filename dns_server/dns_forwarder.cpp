@@ -0,0 +1,355 @@
+#include "dns_forwarder.hpp"
+#include "dns_wire.hpp"
+#include "dns_zone.hpp"
+#include "../src/dns_metrics.hpp"
+#include "../src/dns_simd.hpp"
+#include "../src/dns_view.hpp"
+
+#include <chrono>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// how often an idle forwarder checks if it should stop
+#define DNS_FORWARD_POLL_MS  250
+// how often it lets the resolver retransmit while lookups are out
+#define DNS_FORWARD_TICK_MS   10
+// largest response from upstream
+#define DNS_FORWARD_BUFSIZE  65536
+
+using namespace std;
+
+static uint64_t now_ns()
+{
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(
+      steady_clock::now().time_since_epoch()).count();
+}
+static uint64_t wall_ns()
+{
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(
+      system_clock::now().time_since_epoch()).count();
+}
+
+// the name in lowercase wire format, then the type
+static string lookupKey(const DnsName& name, uint16_t qtype)
+{
+  string key(name.length(), '\0');
+  dns_lower_hash(name.data(), &key[0], name.length());
+  key.push_back(qtype >> 8);
+  key.push_back(qtype & 0xff);
+  return key;
+}
+
+DNS_forwarder::DNS_forwarder(size_t cache_bytes)
+  : cache(cache_bytes), resolver(DNS_FORWARD_DEADLINE_MS), running(false),
+    log(nullptr), ratelimit(nullptr), limited(0)
+{
+  this->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  this->scratch.reset(new char[DNS_FORWARD_BUFSIZE]);
+  resolver.set_cache(&cache);
+}
+
+DNS_forwarder::~DNS_forwarder()
+{
+  stop();
+  close(wakefd);
+}
+
+void DNS_forwarder::add_upstream(const std::string& address, uint16_t port)
+{
+  resolver.add_ns(address, port);
+}
+
+void DNS_forwarder::start()
+{
+  running = true;
+  thread = std::thread([this] { run(); });
+}
+
+void DNS_forwarder::stop()
+{
+  running = false;
+  if (thread.joinable())
+  {
+    uint64_t one = 1;
+    (void) !write(wakefd, &one, sizeof(one));
+    thread.join();
+  }
+}
+
+int DNS_forwarder::forward(int sock, const sockaddr_in& client,
+                           char* buffer, int len, int bufsize)
+{
+  DnsView view;
+  if (!view.parse(buffer, len)) return -1;
+  
+  // only plain queries for one name, anything else is the zone's
+  const dns_header_t& hdr = view.header();
+  if (hdr.qr != DNS_QR_QUERY || hdr.opcode != 0 ||
+      get16((const char*) &hdr.q_count) != 1 || view.qclass() != DNS_CLASS_INET)
+    return -1;
+  
+  lookup_t lookup;
+  lookup.qtype = view.qtype();
+  
+  // everything up to the end of the question is sent back as it came
+  int qend = lookup.name.read(buffer, len, view.qname());
+  if (qend < 0) return -1;
+  qend += sizeof(dns_question_t);
+  
+  waiter_t& waiter = lookup.waiter;
+  waiter.sock   = sock;
+  waiter.addr   = client;
+  waiter.query.assign(buffer, qend);
+  waiter.edns   = false;
+  waiter.maxlen = DNS_UDP_MAX;
+  waiter.arrived = 0;
+  waiter.started = 0;
+  
+  // a client with EDNS(0) takes as much as it says
+  const dns_rr_view_t* rr = view.records(DNS_ADDITIONAL);
+  for (int i = 0; i < view.count(DNS_ADDITIONAL); i++)
+  {
+    if (rr[i].type != DNS_TYPE_OPT) continue;
+    waiter.edns   = true;
+    waiter.maxlen = max<int>(DNS_UDP_MAX, min<int>(rr[i]._class, bufsize));
+  }
+  
+  int cached = cache.lookup(lookup.name, lookup.qtype, DNS_CLASS_INET, buffer, bufsize);
+  if (cached > 0)
+  {
+    int packetlen = respond(waiter, buffer, cached);
+    if (packetlen > 0) return packetlen;
+  }
+  
+  // the name is spelled out to go upstream, and one with dots or
+  // worse inside its labels would be asked for as some other name
+  if (!lookup.name.printable())
+    return fail(waiter, buffer, OP_REFUSED);
+  
+  // only timed if it is going to be logged
+  if (log)
+  {
+    waiter.arrived = wall_ns();
+    waiter.started = now_ns();
+  }
+  
+  // the forwarder drains everything submitted when woken, so it
+  // only needs waking for the first lookup since it last did
+  bool wake;
+  {
+    lock_guard<mutex> guard(lock);
+    wake = submitted.empty();
+    submitted.push_back(std::move(lookup));
+  }
+  DnsMetrics::count(DNS_SERVER_FORWARDED);
+  if (wake)
+  {
+    uint64_t one = 1;
+    (void) !write(wakefd, &one, sizeof(one));
+  }
+  return 0;
+}
+
+void DNS_forwarder::run()
+{
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  
+  epoll_event ev;
+  ev.events  = EPOLLIN;
+  ev.data.fd = wakefd;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev);
+  ev.data.fd = resolver.fd();
+  epoll_ctl(epfd, EPOLL_CTL_ADD, resolver.fd(), &ev);
+  
+  vector<lookup_t> lookups;
+  
+  while (running)
+  {
+    // keep the resolver's timers ticking while lookups are out
+    int timeout = resolver.outstanding() ? DNS_FORWARD_TICK_MS : DNS_FORWARD_POLL_MS;
+    
+    epoll_event events[2];
+    int count = epoll_wait(epfd, events, 2, timeout);
+    
+    for (int i = 0; i < count; i++)
+    {
+      if (events[i].data.fd != wakefd) continue;
+      
+      uint64_t value;
+      (void) !read(wakefd, &value, sizeof(value));
+      {
+        lock_guard<mutex> guard(lock);
+        lookups.swap(submitted);
+      }
+      for (auto& lookup : lookups)
+        submit(lookup);
+      lookups.clear();
+    }
+    // the replies that woke us, and the timers that are due
+    resolver.process(0);
+  }
+  close(epfd);
+}
+
+void DNS_forwarder::submit(lookup_t& lookup)
+{
+  string key = lookupKey(lookup.name, lookup.qtype);
+  
+  vector<waiter_t>& waiters = inflight[key];
+  if (waiters.size() >= DNS_FORWARD_MAX_WAITERS) return;
+  waiters.push_back(std::move(lookup.waiter));
+  
+  // someone is already asking, the answer will do for this one too
+  if (waiters.size() > 1) return;
+  
+  // only a query that goes upstream is ever spelled out
+  char name[DNS_NAME_MAX];
+  lookup.name.toText(name, sizeof(name));
+  
+  // this may well answer right away, from the cache
+  bool sent = resolver.outstanding() < DNS_FORWARD_MAX_LOOKUPS &&
+    resolver.resolve(name,
+    [this, key] (bool resolved, DnsRequest&)
+    {
+      answer(key, resolved);
+    }, lookup.qtype);
+  
+  if (!sent) answer(key, false);
+}
+
+void DNS_forwarder::answer(const std::string& key, bool resolved)
+{
+  auto it = inflight.find(key);
+  if (it == inflight.end()) return;
+  
+  vector<waiter_t> waiters = std::move(it->second);
+  inflight.erase(it);
+  
+  int len = 0;
+  const char* response = resolved ? resolver.getResponse(len) : nullptr;
+  char* buffer = scratch.get();
+  
+  for (auto& waiter : waiters)
+  {
+    int packetlen = 0;
+    if (response)
+    {
+      memcpy(buffer, response, len);
+      packetlen = respond(waiter, buffer, len);
+    }
+    if (packetlen == 0)
+      packetlen = fail(waiter, buffer, SERVER_FAIL);
+    
+    dns_rrl_verdict_t verdict = ratelimit
+        ? ratelimit->check(waiter.addr.sin_addr.s_addr, buffer, packetlen,
+                           now_ns() / 1000000, limited)
+        : DNS_RRL_SEND;
+    if (verdict == DNS_RRL_DROP)
+    {
+      DnsMetrics::count(DNS_SERVER_RATE_LIMITED);
+      continue;
+    }
+    if (verdict == DNS_RRL_TRUNCATE)
+    {
+      packetlen = DNS_ratelimit::truncate(buffer, packetlen);
+      DnsMetrics::count(DNS_SERVER_SLIPPED);
+    }
+    
+    DnsMetrics::response(buffer);
+    sendto(waiter.sock, buffer, packetlen, 0,
+           (const sockaddr*) &waiter.addr, sizeof(waiter.addr));
+    
+    dns_log_record_t* rec = log ? log->reserve() : nullptr;
+    if (rec)
+    {
+      dns_log_response(*rec, buffer, packetlen);
+      rec->time_ns    = waiter.arrived;
+      rec->latency_ns = min<uint64_t>(now_ns() - waiter.started, UINT32_MAX);
+      rec->client     = waiter.addr.sin_addr.s_addr;
+      rec->port       = waiter.addr.sin_port;
+      rec->flags     |= DNS_LOG_FORWARDED;
+      log->commit();
+    }
+    else if (log)
+      DnsMetrics::count(DNS_SERVER_LOG_DROPPED);
+  }
+}
+
+int DNS_forwarder::respond(const waiter_t& waiter, char* buffer, int len)
+{
+  DnsView view;
+  if (!view.parse(buffer, len)) return 0;
+  
+  // the question must be the one asked: the same name, whatever
+  // its case, and the same type and class
+  int qend = DnsView::checkName((const unsigned char*) buffer, len, view.qname())
+           + sizeof(dns_question_t);
+  if (qend != (int) waiter.query.size()) return 0;
+  
+  int namelen = qend - sizeof(dns_header_t) - sizeof(dns_question_t);
+  const char* asked = waiter.query.data() + sizeof(dns_header_t);
+  const char* given = buffer + sizeof(dns_header_t);
+  if (!DnsName::equalWire(asked, given, namelen) ||
+      memcmp(asked + namelen, given + namelen, sizeof(dns_question_t)) != 0)
+    return 0;
+  
+  // the question as the client spelled it, and its ID and flags
+  const dns_header_t& query = *(const dns_header_t*) waiter.query.data();
+  dns_header_t& hdr = *(dns_header_t*) buffer;
+  memcpy(buffer + sizeof(dns_header_t), waiter.query.data() + sizeof(dns_header_t),
+         qend - sizeof(dns_header_t));
+  
+  hdr.id = query.id;
+  hdr.rd = query.rd;
+  hdr.cd = query.cd;
+  hdr.aa = 0;
+  hdr.ra = 1;
+  
+  // the OPT record from upstream means nothing to a client without EDNS,
+  // it is always the last record in practice, so cut it off there
+  if (!waiter.edns && !view.overflowed())
+  {
+    const dns_rr_view_t* rr = view.records(DNS_ADDITIONAL);
+    int count = view.count(DNS_ADDITIONAL);
+    
+    if (count > 0 && rr[count-1].type == DNS_TYPE_OPT &&
+        rr[count-1].rdata + rr[count-1].rdlength == len)
+    {
+      len = rr[count-1].name;
+      put16((char*) &hdr.add_count, count - 1);
+    }
+  }
+  
+  // too big for the client, it asks again over TCP
+  if (len > waiter.maxlen)
+  {
+    hdr.tc = 1;
+    hdr.ans_count  = 0;
+    hdr.auth_count = 0;
+    hdr.add_count  = 0;
+    return qend;
+  }
+  return len;
+}
+
+int DNS_forwarder::fail(const waiter_t& waiter, char* buffer, int rcode)
+{
+  memcpy(buffer, waiter.query.data(), waiter.query.size());
+  dns_header_t& hdr = *(dns_header_t*) buffer;
+  
+  hdr.qr = DNS_QR_RESPONSE;
+  hdr.tc = 0;
+  hdr.aa = 0;
+  hdr.ra = 1;
+  hdr.z  = 0;
+  hdr.ad = 0;
+  hdr.rcode = rcode;
+  hdr.ans_count  = 0;
+  hdr.auth_count = 0;
+  hdr.add_count  = 0;
+  return waiter.query.size();
+}
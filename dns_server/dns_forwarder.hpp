@@ -0,0 +1,114 @@
+#ifndef DNS_FORWARDER_HPP
+#define DNS_FORWARDER_HPP
+
+#include "../src/async_dns.hpp"
+#include "../src/dns_cache.hpp"
+#include "dns_logring.hpp"
+#include "dns_ratelimit.hpp"
+
+#include <netinet/in.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// how long an upstream lookup may take before the clients get SERVFAIL
+#define DNS_FORWARD_DEADLINE_MS  3000
+// clients waiting for the same answer, at most, the rest are dropped
+#define DNS_FORWARD_MAX_WAITERS  256
+// upstream lookups outstanding at most, beyond that clients get SERVFAIL
+#define DNS_FORWARD_MAX_LOOKUPS  4096
+
+/**
+ * Forwards the queries a zone can't answer to upstream nameservers,
+ * and caches their answers
+ *
+ * Workers answer cache hits themselves, in place, like they answer
+ * from the zone. Misses are handed to a thread of its own, which runs
+ * the asynchronous resolver and sends the answers back on the socket
+ * each query came in on. Identical queries (same name, type and class)
+ * arriving while one is already being looked up don't go upstream
+ * again: they wait for that one, and its answer is sent to them all,
+ * so a popular name that just expired costs our upstreams one query,
+ * not one per client.
+**/
+class DNS_forwarder
+{
+public:
+  DNS_forwarder(size_t cache_bytes = 64 << 20);
+  ~DNS_forwarder();
+  
+  // before start()
+  void add_upstream(const std::string& address, uint16_t port = 53);
+  // log the queries answered from upstream into ring, before start()
+  void set_log(DNS_logring* ring)
+  {
+    this->log = ring;
+  }
+  // limit the answers from upstream along with the rest, before start()
+  void set_ratelimit(DNS_ratelimit* ratelimit)
+  {
+    this->ratelimit = ratelimit;
+  }
+  
+  void start();
+  void stop();
+  
+  // answer the query of len bytes in buffer from the cache, in place,
+  // returns the length of the response, 0 if it was sent upstream and
+  // will be answered later on sock, or -1 if it isn't ours to answer
+  int forward(int sock, const sockaddr_in& client,
+              char* buffer, int len, int bufsize);
+
+private:
+  // a client waiting for an answer
+  struct waiter_t
+  {
+    int sock;
+    sockaddr_in addr;
+    std::string query; // its header and question
+    bool edns;         // sent an OPT record
+    int maxlen;        // largest response it takes
+    uint64_t arrived;  // wall clock, for the query log
+    uint64_t started;  // steady clock, for the query log
+  };
+  struct lookup_t
+  {
+    DnsName  name;
+    uint16_t qtype;
+    waiter_t waiter;
+  };
+  
+  void run();
+  void submit(lookup_t& lookup);
+  void answer(const std::string& key, bool resolved);
+  
+  // turn the response of len bytes in buffer into the response to
+  // waiter, in place, returns its length or 0 to drop it
+  static int respond(const waiter_t& waiter, char* buffer, int len);
+  static int fail(const waiter_t& waiter, char* buffer, int rcode);
+  
+  DnsCache cache;
+  AsyncDNS resolver;
+  std::thread thread;
+  std::atomic<bool> running;
+  int wakefd;
+  std::unique_ptr<char[]> scratch; // responses being sent
+  DNS_logring* log; // nullptr when not logging
+  DNS_ratelimit* ratelimit; // nullptr when not limiting
+  uint32_t limited;
+  
+  // handed over by the workers
+  std::mutex lock;
+  std::vector<lookup_t> submitted;
+  
+  // the clients waiting for each lookup, by name, type and class,
+  // only touched by the forwarder thread
+  std::unordered_map<std::string, std::vector<waiter_t>> inflight;
+};
+
+#endif
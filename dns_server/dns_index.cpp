@@ -0,0 +1,869 @@
+#include "dns_index.hpp"
+#include "dns_wire.hpp"
+#include "../src/dns.hpp"
+#include "../src/dns_simd.hpp"
+
+#include <algorithm>
+#include <set>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// zone image layout: the header, then slots, Bloom filter, branch filter,
+// nodes, names and data pool, each starting on an 8-byte boundary, all in
+// host byte order
+#define ZONE_IMAGE_MAGIC   "DNSDZONE"
+#define ZONE_IMAGE_VERSION 6
+
+struct zone_image_t
+{
+  char     magic[8];
+  uint32_t version;
+  uint32_t entries;    // names in the index
+  uint32_t slots;      // number of slots, a power of two
+  uint32_t slots_off;
+  uint32_t bloom_off;
+  uint32_t bloom_blocks; // a power of two
+  uint32_t branches_off;
+  uint32_t branch_words; // a power of two, 0 for no tree
+  uint32_t nodes_off;
+  uint32_t nodes;      // 0 for no tree
+  uint32_t names_off;
+  uint32_t names_size; // bytes
+  uint32_t pool_off;
+  uint32_t pool_size;  // bytes
+  DNS_index::apex_t apex;
+  uint64_t branch_lengths[4];
+};
+
+// an A record pointing at the question: name, type, class, ttl, length, address
+#define A_ANSWER_SIZE  16
+// answers that fit in the largest message there is
+#define ANSWERS_MAX    (65535 / A_ANSWER_SIZE)
+// an SOA record pointing at the question: name, type, class, ttl,
+// length, two names and five numbers
+#define SOA_RECORD_MAX (2 + 10 + 2 * DNS_WIRE_NAME_MAX + 20)
+// the largest referral we put together
+#define REFERRAL_MAX   4096
+// children of a node looked through one by one, rather than searched
+#define TREE_SCAN_MAX  8
+
+static inline size_t align8(size_t n)
+{
+  return (n + 7) & ~(size_t) 7;
+}
+
+// the hash of a label in wire format, length first, what siblings
+// in the tree are sorted by
+static inline uint32_t labelHash(const char* label)
+{
+  return dns_lower_hash(label, nullptr, 1 + (uint8_t) label[0]);
+}
+
+// the offset of the compression pointer the name of len bytes just
+// written at pos ends in, or -1 if it is written out in full (names
+// are visible ASCII, so only a pointer has a byte from 0xc0 up)
+static inline int pointerIn(const char* message, int pos, int len)
+{
+  return (len >= 2 && (uint8_t) message[pos + len - 2] >= 0xc0) ? pos + len - 2 : -1;
+}
+
+// true if the name in wire format is name, or under it
+static bool under(const std::string& wire, const std::string& name)
+{
+  size_t pos = 0;
+  while (wire.size() - pos > name.size())
+    pos += 1 + (uint8_t) wire[pos];
+  return wire.compare(pos, std::string::npos, name) == 0;
+}
+
+DNS_index::DNS_index()
+  : slots(nullptr), bloom(nullptr), nodes(nullptr), branches(nullptr), names(nullptr),
+    pool(nullptr), mask(0), bloom_mask(0), branch_mask(0), count(0),
+    mapping(nullptr), mapsize(0)
+{
+  memset(&apex, 0, sizeof(apex));
+  memset(branch_lengths, 0, sizeof(branch_lengths));
+}
+
+DNS_index::~DNS_index()
+{
+  unmap();
+}
+
+int DNS_index::hashName(const char* name, const char* end, uint32_t& hash, char* lower)
+{
+  return DnsName::hashWire(name, end, hash, lower);
+}
+
+void DNS_index::build(const std::map<std::string, mapping_t>& table, const soa_t& soa)
+{
+  unmap();
+  name_store.clear();
+  pool_store.clear();
+  node_store.clear();
+  branch_store.clear();
+  
+  // www.google.com. to 3www6google3com0, in lowercase
+  std::map<std::string, const mapping_t*> owners;
+  for (auto& mapping : table)
+  {
+    DnsName name;
+    if (!name.parse(mapping.first.c_str())) continue;
+    
+    char wire[DNS_WIRE_NAME_MAX];
+    uint32_t hash;
+    int len = hashName(name.data(), name.data() + name.length(), hash, wire);
+    if (len == name.length()) owners[std::string(wire, len)] = &mapping.second;
+  }
+  std::string top;
+  DnsName apexname;
+  if (!soa.apex.empty() && apexname.parse(soa.apex.c_str()))
+  {
+    char wire[DNS_WIRE_NAME_MAX];
+    uint32_t hash;
+    int len = hashName(apexname.data(), apexname.data() + apexname.length(), hash, wire);
+    top.assign(wire, len);
+  }
+  
+  // names with nameservers are delegated, but the apex itself
+  std::set<std::string> cuts;
+  for (auto& owner : owners)
+    if (!owner.second->nameservers.empty() && owner.first != top)
+      cuts.insert(owner.first);
+  
+  // the names we answer for, with their records; anything at
+  // or below a cut is someone else's
+  std::map<std::string, const mapping_t*> present;
+  std::vector<std::string> wildcards;
+  for (auto& owner : owners)
+  {
+    const std::string& wire = owner.first;
+    bool delegated = false;
+    for (size_t pos = 0; pos < wire.size() && !delegated; pos += 1 + (uint8_t) wire[pos])
+      delegated = cuts.count(wire.substr(pos)) != 0;
+    if (delegated) continue;
+    
+    present[wire] = owner.second;
+    if (wire[0] == 1 && wire[1] == '*') wildcards.push_back(wire);
+  }
+  
+  // and those only there for the names under them (nullptr), which
+  // the apex has all of, as does any name with a wildcard, since a
+  // wildcard only answers for names under it that aren't there
+  std::vector<std::string> tops;
+  if (!top.empty()) tops.push_back(top);
+  for (auto& wildcard : wildcards) tops.push_back(wildcard.substr(2));
+  
+  std::vector<std::string> named;
+  for (auto& name : present) named.push_back(name.first);
+  for (auto& wire : named)
+  {
+    for (size_t pos = 1 + (uint8_t) wire[0]; pos < wire.size(); pos += 1 + (uint8_t) wire[pos])
+    {
+      std::string parent = wire.substr(pos);
+      for (auto& name : tops)
+        if (parent.size() >= name.size() && under(parent, name))
+        {
+          present.insert(std::make_pair(parent, nullptr));
+          break;
+        }
+    }
+  }
+  for (auto& name : tops)
+    present.insert(std::make_pair(name, nullptr));
+  
+  // at most half full, so probe sequences stay short
+  size_t capacity = 16;
+  while (capacity < present.size() * 2) capacity *= 2;
+  
+  slot_store.assign(capacity, entry_t());
+  mask  = capacity - 1;
+  count = 0;
+  
+  // the names with nothing to answer all share the one empty answer
+  uint32_t empty = pool_store.size();
+  pool_store.resize(empty + 2, 0);
+  
+  std::map<std::string, uint32_t> answers;
+  for (auto& name : present)
+  {
+    const std::string& wire = name.first;
+    uint32_t hash;
+    hashName(wire.data(), wire.data() + wire.size(), hash);
+    
+    // the zone map has no duplicates, so just find a free slot
+    uint32_t idx = hash & mask;
+    while (slot_store[idx].length) idx = (idx + 1) & mask;
+    
+    entry_t& entry = slot_store[idx];
+    entry.hash   = hash;
+    entry.name   = name_store.size();
+    entry.length = wire.size();
+    entry.data   = empty;
+    entry.count  = 0;
+    if (name.second && !name.second->addrs.empty())
+    {
+      DnsName owner;
+      owner.read(wire.data(), wire.size(), 0);
+      entry.data  = addAnswers(owner, *name.second);
+      // more than this could never go in one response anyway
+      entry.count = std::min(name.second->addrs.size(), (size_t) ANSWERS_MAX);
+    }
+    answers[wire] = entry.data;
+    
+    name_store.insert(name_store.end(), wire.begin(), wire.end());
+    count++;
+  }
+  buildBloom();
+  buildSOA(soa);
+  
+  // the tree is only there for what the table can't answer, and only
+  // needs the way down to the wildcards and the cuts, whether any other
+  // name is there or not, the table knows
+  if (!wildcards.empty() || !cuts.empty())
+  {
+    std::vector<std::string> hangers(cuts.begin(), cuts.end());
+    for (auto& wildcard : wildcards) hangers.push_back(wildcard.substr(2));
+    buildBranches(hangers);
+    
+    wildcards.insert(wildcards.end(), cuts.begin(), cuts.end());
+    buildTree(owners, cuts, wildcards, answers);
+  }
+  
+  slots = slot_store.data();
+  bloom = bloom_store.data();
+  nodes = node_store.empty() ? nullptr : node_store.data();
+  branches = branch_store.empty() ? nullptr : branch_store.data();
+  names = name_store.data();
+  pool  = pool_store.data();
+}
+
+uint32_t DNS_index::addAnswers(const DnsName& name, const mapping_t& mapping)
+{
+  const std::vector<uint32_t>& addrs = mapping.addrs;
+  int len   = name.length();
+  int count = std::min(addrs.size(), (size_t) ANSWERS_MAX);
+  
+  // the answers are written as they will be in the response, after
+  // the header and the question, so names compress the same way
+  int qend = sizeof(dns_header_t) + len + sizeof(dns_question_t);
+  int size = count * A_ANSWER_SIZE;
+  std::vector<char> message(qend + size);
+  memcpy(&message[sizeof(dns_header_t)], name.data(), len);
+  
+  DnsNameEncoder encoder(message.data(), message.size());
+  encoder.remember(sizeof(dns_header_t));
+  
+  int pos = qend;
+  for (int i = 0; i < count; i++)
+  {
+    // the owner is always the question, so just a pointer
+    pos += encoder.write(pos, name, message.size() - pos);
+    put16(&message[pos], DNS_TYPE_A);
+    put16(&message[pos + 2], DNS_CLASS_INET);
+    put32(&message[pos + 4], mapping.ttl);
+    put16(&message[pos + 8], sizeof(uint32_t));
+    memcpy(&message[pos + 10], &addrs[i], sizeof(uint32_t));
+    pos += sizeof(dns_rr_data_t) + sizeof(uint32_t);
+  }
+  
+  // the size of the answers, then the answers
+  uint32_t data = pool_store.size();
+  pool_store.resize(data + 2 + size);
+  put16(&pool_store[data], size);
+  memcpy(&pool_store[data + 2], &message[qend], size);
+  return data;
+}
+
+uint32_t DNS_index::addSection(const char* records, int size, int additional,
+                               const std::vector<uint16_t>& patches)
+{
+  // its size, how many of its records are additional, the pointers
+  // to move, then the records
+  uint32_t data = pool_store.size();
+  pool_store.resize(data + 6 + 2 * patches.size() + size);
+  
+  char* out = &pool_store[data];
+  put16(out, size);
+  put16(out + 2, additional);
+  put16(out + 4, patches.size());
+  for (size_t i = 0; i < patches.size(); i++)
+    put16(out + 6 + 2 * i, patches[i]);
+  memcpy(out + 6 + 2 * patches.size(), records, size);
+  return data;
+}
+
+void DNS_index::buildBloom()
+{
+  size_t blocks = 1;
+  while (blocks * DNS_BLOOM_WORDS * 32 < count * DNS_BLOOM_BITS_PER_NAME) blocks *= 2;
+  
+  bloom_store.assign(blocks * DNS_BLOOM_WORDS, 0);
+  bloom_mask = blocks - 1;
+  
+  // set the bits mayContain() looks for
+  for (auto& entry : slot_store)
+  {
+    if (entry.length == 0) continue;
+    uint32_t* block = &bloom_store[bloomBlock(entry.hash)];
+    for (int i = 0; i < DNS_BLOOM_WORDS; i++)
+      block[i] |= bloomBit(entry.hash, i);
+  }
+}
+
+void DNS_index::buildBranches(const std::vector<std::string>& names)
+{
+  size_t words = 1;
+  while (words * 64 < names.size() * DNS_BRANCH_BITS_PER_NAME) words *= 2;
+  
+  branch_store.assign(words, 0);
+  branch_mask = words - 1;
+  
+  // set the bits mayBranch() looks for
+  for (auto& wire : names)
+  {
+    uint32_t hash;
+    hashName(wire.data(), wire.data() + wire.size(), hash);
+    branch_store[(hash * 0x9e3779b97f4a7c15ull) >> 32 & branch_mask] |=
+        1ull << (hash >> 26) | 1ull << (hash >> 20 & 63);
+    branch_lengths[wire.size() >> 6] |= 1ull << (wire.size() & 63);
+  }
+}
+
+void DNS_index::buildSOA(const soa_t& soa)
+{
+  memset(&apex, 0, sizeof(apex));
+  if (soa.apex.empty()) return;
+  
+  DnsName owner, mname, rname;
+  if (!owner.parse(soa.apex.c_str()) || !mname.parse(soa.mname.c_str()) ||
+      !rname.parse(soa.rname.c_str())) return;
+  
+  char wire[DNS_WIRE_NAME_MAX];
+  int  len = owner.length();
+  uint32_t hash;
+  if (hashName(owner.data(), owner.data() + len, hash, wire) != len) return;
+  
+  // the record is written as it goes in the response to a question
+  // for the apex itself; a longer question moves it along by as many
+  // bytes, and every pointer in it by as much
+  int qend = sizeof(dns_header_t) + len + sizeof(dns_question_t);
+  std::vector<char> message(qend + SOA_RECORD_MAX);
+  memcpy(&message[sizeof(dns_header_t)], wire, len);
+  
+  DnsNameEncoder encoder(message.data(), message.size());
+  encoder.remember(sizeof(dns_header_t));
+  std::vector<uint16_t> patches;
+  
+  // the owner is the apex, which always ends the question
+  int pos = qend;
+  put16(&message[pos], 0xc000 | sizeof(dns_header_t));
+  patches.push_back(0);
+  put16(&message[pos + 2], DNS_TYPE_SOA);
+  put16(&message[pos + 4], DNS_CLASS_INET);
+  // negative answers are cached for the lesser of the two (RFC 2308)
+  put32(&message[pos + 6], std::min(soa.ttl, soa.minimum));
+  
+  int rdata = pos + 2 + sizeof(dns_rr_data_t);
+  int end = rdata;
+  for (const DnsName* name : { &mname, &rname })
+  {
+    int n = encoder.write(end, *name, message.size() - end);
+    int pointer = pointerIn(message.data(), end, n);
+    if (pointer >= 0) patches.push_back(pointer - pos);
+    end += n;
+  }
+  const uint32_t numbers[5] = { soa.serial, soa.refresh, soa.retry, soa.expire, soa.minimum };
+  for (uint32_t number : numbers)
+  {
+    put32(&message[end], number);
+    end += sizeof(uint32_t);
+  }
+  put16(&message[pos + 10], end - rdata);
+  
+  apex.name   = name_store.size();
+  apex.length = len;
+  apex.data   = addSection(&message[pos], end - pos, 0, patches);
+  apex.ttl    = soa.ttl;
+  name_store.insert(name_store.end(), wire, wire + len);
+}
+
+void DNS_index::buildTree(const std::map<std::string, const mapping_t*>& owners,
+                          const std::set<std::string>& cuts,
+                          const std::vector<std::string>& names,
+                          const std::map<std::string, uint32_t>& answers)
+{
+  // first as a tree of names, each knowing its children
+  struct branch_t
+  {
+    std::string name;
+    std::vector<int> children;
+  };
+  std::vector<branch_t> branches(1, branch_t { std::string(1, '\0'), {} });
+  std::map<std::string, int> known;
+  known[branches[0].name] = 0;
+  
+  for (auto& wire : names)
+  {
+    // from the root down, adding whatever isn't there yet
+    std::vector<size_t> starts;
+    for (size_t pos = 0; pos + 1 < wire.size(); pos += 1 + (uint8_t) wire[pos])
+      starts.push_back(pos);
+    
+    int parent = 0;
+    for (size_t i = starts.size(); i-- > 0; )
+    {
+      std::string name = wire.substr(starts[i]);
+      auto it = known.find(name);
+      if (it == known.end())
+      {
+        it = known.insert(std::make_pair(name, (int) branches.size())).first;
+        branches.push_back(branch_t { name, {} });
+        branches[parent].children.push_back(it->second);
+      }
+      parent = it->second;
+    }
+  }
+  
+  // then laid out a level at a time, so that every node's children
+  // are next to each other, the wildcard first, then by their hash
+  std::vector<int> order(1, 0);
+  node_store.assign(branches.size(), node_t());
+  for (size_t i = 0; i < order.size(); i++)
+  {
+    branch_t& branch = branches[order[i]];
+    node_t&   node   = node_store[i];
+    const char* label = branch.name.data();
+    
+    node.hash   = labelHash(label);
+    node.label  = name_store.size();
+    node.length = branch.name.size();
+    name_store.insert(name_store.end(), label, label + 1 + (uint8_t) label[0]);
+    
+    struct child_t
+    {
+      bool     wildcard;
+      uint32_t hash;
+      int      branch;
+    };
+    std::vector<child_t> children;
+    for (int child : branch.children)
+    {
+      const char* first = branches[child].name.data();
+      bool wildcard = first[0] == 1 && first[1] == '*';
+      if (wildcard) node.flags |= DNS_NODE_WILDCARD;
+      children.push_back(child_t { wildcard, labelHash(first), child });
+    }
+    std::sort(children.begin(), children.end(),
+    [] (const child_t& a, const child_t& b)
+    {
+      if (a.wildcard != b.wildcard) return a.wildcard;
+      return a.hash < b.hash;
+    });
+    node.children = order.size();
+    node.count    = children.size();
+    for (auto& child : children)
+      order.push_back(child.branch);
+    
+    // what it answers with, if anything
+    auto answer = answers.find(branch.name);
+    if (cuts.count(branch.name))
+    {
+      const mapping_t& mapping = *owners.find(branch.name)->second;
+      node.flags  |= DNS_NODE_CUT;
+      node.data    = buildReferral(branch.name, mapping, owners, node.records);
+    }
+    else if (answer != answers.end())
+    {
+      node.data    = answer->second;
+      node.records = get16(&pool_store[answer->second]) / A_ANSWER_SIZE;
+      if (node.records) node.flags |= DNS_NODE_DATA;
+    }
+  }
+}
+
+uint32_t DNS_index::buildReferral(const std::string& cut, const mapping_t& mapping,
+                                  const std::map<std::string, const mapping_t*>& owners,
+                                  uint16_t& records)
+{
+  DnsName owner;
+  owner.read(cut.data(), cut.size(), 0);
+  int len = owner.length();
+  
+  // like the SOA record, written for a question for the cut itself
+  int qend = sizeof(dns_header_t) + len + sizeof(dns_question_t);
+  std::vector<char> message(qend + REFERRAL_MAX);
+  memcpy(&message[sizeof(dns_header_t)], cut.data(), len);
+  
+  DnsNameEncoder encoder(message.data(), message.size());
+  encoder.remember(sizeof(dns_header_t));
+  std::vector<uint16_t> patches;
+  
+  int pos = qend;
+  int servers = 0;
+  std::vector<DnsName> targets;
+  for (auto& server : mapping.nameservers)
+  {
+    DnsName target;
+    if (!target.parse(server.c_str()) ||
+        pos + 2 + (int) sizeof(dns_rr_data_t) + target.length() > (int) message.size()) continue;
+    targets.push_back(target);
+    servers++;
+    
+    put16(&message[pos], 0xc000 | sizeof(dns_header_t));
+    patches.push_back(pos - qend);
+    put16(&message[pos + 2], DNS_TYPE_NS);
+    put16(&message[pos + 4], DNS_CLASS_INET);
+    put32(&message[pos + 6], mapping.ns_ttl);
+    
+    int rdata = pos + 2 + sizeof(dns_rr_data_t);
+    int n = encoder.write(rdata, target, message.size() - rdata);
+    int pointer = pointerIn(message.data(), rdata, n);
+    if (pointer >= 0) patches.push_back(pointer - qend);
+    put16(&message[pos + 10], n);
+    pos = rdata + n;
+  }
+  
+  // and the addresses of those the zone has them for: glue for
+  // those under the cut, which no one else could give, and the
+  // zone's own for the rest, to save the resolver asking
+  int additional = 0;
+  for (auto& target : targets)
+  {
+    char wire[DNS_WIRE_NAME_MAX];
+    uint32_t hash;
+    int len = hashName(target.data(), target.data() + target.length(), hash, wire);
+    auto it = owners.find(std::string(wire, len));
+    if (it == owners.end()) continue;
+    
+    for (uint32_t addr : it->second->addrs)
+    {
+      int n = encoder.write(pos, target, message.size() - pos);
+      if (n < 0 || pos + n + A_ANSWER_SIZE > (int) message.size()) break;
+      int pointer = pointerIn(message.data(), pos, n);
+      if (pointer >= 0) patches.push_back(pointer - qend);
+      pos += n;
+      
+      put16(&message[pos], DNS_TYPE_A);
+      put16(&message[pos + 2], DNS_CLASS_INET);
+      put32(&message[pos + 4], it->second->ttl);
+      put16(&message[pos + 8], sizeof(uint32_t));
+      memcpy(&message[pos + 10], &addr, sizeof(uint32_t));
+      pos += sizeof(dns_rr_data_t) + sizeof(uint32_t);
+      additional++;
+    }
+  }
+  records = servers;
+  return addSection(&message[qend], pos - qend, additional, patches);
+}
+
+bool DNS_index::save(const std::string& path) const
+{
+  zone_image_t hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, ZONE_IMAGE_MAGIC, sizeof(hdr.magic));
+  
+  hdr.version    = ZONE_IMAGE_VERSION;
+  hdr.entries    = count;
+  hdr.slots      = mask + 1;
+  hdr.slots_off  = align8(sizeof(hdr));
+  hdr.bloom_off  = align8(hdr.slots_off + hdr.slots * sizeof(entry_t));
+  hdr.bloom_blocks = bloom_mask + 1;
+  hdr.branches_off = align8(hdr.bloom_off + hdr.bloom_blocks * DNS_BLOOM_WORDS * sizeof(uint32_t));
+  hdr.branch_words = branch_store.size();
+  hdr.nodes_off  = align8(hdr.branches_off + hdr.branch_words * sizeof(uint64_t));
+  hdr.nodes      = node_store.size();
+  hdr.names_off  = align8(hdr.nodes_off + hdr.nodes * sizeof(node_t));
+  hdr.names_size = name_store.size();
+  hdr.pool_off   = align8(hdr.names_off + hdr.names_size);
+  hdr.pool_size  = pool_store.size();
+  hdr.apex       = apex;
+  memcpy(hdr.branch_lengths, branch_lengths, sizeof(branch_lengths));
+  
+  // only a built index can be saved
+  if (slots == nullptr || slots != slot_store.data()) return false;
+  
+  FILE* file = fopen(path.c_str(), "wb");
+  if (file == nullptr) return false;
+  
+  const char zeros[8] = { 0 };
+  bool ok = true;
+  
+  ok &= fwrite(&hdr, sizeof(hdr), 1, file) == 1;
+  ok &= fwrite(zeros, hdr.slots_off - sizeof(hdr), 1, file) <= 1;
+  ok &= fwrite(slots, sizeof(entry_t), hdr.slots, file) == hdr.slots;
+  ok &= fwrite(zeros, hdr.bloom_off - hdr.slots_off - hdr.slots * sizeof(entry_t), 1, file) <= 1;
+  ok &= fwrite(bloom, sizeof(uint32_t), bloom_store.size(), file) == bloom_store.size();
+  ok &= fwrite(zeros, hdr.branches_off - hdr.bloom_off - bloom_store.size() * sizeof(uint32_t), 1, file) <= 1;
+  ok &= fwrite(branch_store.data(), sizeof(uint64_t), hdr.branch_words, file) == hdr.branch_words;
+  ok &= fwrite(zeros, hdr.nodes_off - hdr.branches_off - hdr.branch_words * sizeof(uint64_t), 1, file) <= 1;
+  ok &= fwrite(node_store.data(), sizeof(node_t), hdr.nodes, file) == hdr.nodes;
+  ok &= fwrite(zeros, hdr.names_off - hdr.nodes_off - hdr.nodes * sizeof(node_t), 1, file) <= 1;
+  ok &= fwrite(names, 1, hdr.names_size, file) == hdr.names_size;
+  ok &= fwrite(zeros, hdr.pool_off - hdr.names_off - hdr.names_size, 1, file) <= 1;
+  ok &= fwrite(pool, 1, hdr.pool_size, file) == hdr.pool_size;
+  
+  ok &= fclose(file) == 0;
+  return ok;
+}
+
+bool DNS_index::map(const std::string& path)
+{
+#ifdef __linux__
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(zone_image_t))
+  {
+    close(fd);
+    return false;
+  }
+  
+  size_t size = st.st_size;
+  void*  addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) return false;
+  
+  // only the layout is checked, the contents are trusted to be what
+  // the zone compiler made, so mapping never depends on the zone size
+  const zone_image_t& hdr = *(const zone_image_t*) addr;
+  
+  bool valid = memcmp(hdr.magic, ZONE_IMAGE_MAGIC, sizeof(hdr.magic)) == 0
+      && hdr.version == ZONE_IMAGE_VERSION
+      && hdr.slots >= 16 && (hdr.slots & (hdr.slots - 1)) == 0
+      && hdr.slots_off + (uint64_t) hdr.slots * sizeof(entry_t) <= hdr.bloom_off
+      && hdr.bloom_blocks && (hdr.bloom_blocks & (hdr.bloom_blocks - 1)) == 0
+      && hdr.bloom_off + (uint64_t) hdr.bloom_blocks * DNS_BLOOM_WORDS * sizeof(uint32_t) <= hdr.branches_off
+      && (hdr.branch_words & (hdr.branch_words - 1)) == 0
+      && (hdr.branch_words != 0) == (hdr.nodes != 0)
+      && hdr.branches_off + (uint64_t) hdr.branch_words * sizeof(uint64_t) <= hdr.nodes_off
+      && hdr.nodes_off + (uint64_t) hdr.nodes * sizeof(node_t) <= hdr.names_off
+      && hdr.names_off + (uint64_t) hdr.names_size <= hdr.pool_off
+      && hdr.pool_off  + (uint64_t) hdr.pool_size <= size;
+  
+  if (!valid)
+  {
+    munmap(addr, size);
+    return false;
+  }
+  
+  unmap();
+  slot_store.clear();
+  bloom_store.clear();
+  branch_store.clear();
+  node_store.clear();
+  name_store.clear();
+  pool_store.clear();
+  
+  this->mapping = addr;
+  this->mapsize = size;
+  
+  const char* base = (const char*) addr;
+  slots = (const entry_t*)  (base + hdr.slots_off);
+  bloom = (const uint32_t*) (base + hdr.bloom_off);
+  nodes = hdr.nodes ? (const node_t*) (base + hdr.nodes_off) : nullptr;
+  branches = hdr.branch_words ? (const uint64_t*) (base + hdr.branches_off) : nullptr;
+  names = (const char*)     (base + hdr.names_off);
+  pool  = (const char*)     (base + hdr.pool_off);
+  mask  = hdr.slots - 1;
+  bloom_mask = hdr.bloom_blocks - 1;
+  branch_mask = hdr.branch_words - 1;
+  count = hdr.entries;
+  apex  = hdr.apex;
+  memcpy(branch_lengths, hdr.branch_lengths, sizeof(branch_lengths));
+  return true;
+#else
+  (void) path;
+  return false;
+#endif
+}
+
+void DNS_index::unmap()
+{
+#ifdef __linux__
+  if (mapping) munmap(mapping, mapsize);
+#endif
+  mapping = nullptr;
+  mapsize = 0;
+  slots = nullptr;
+  bloom = nullptr;
+  nodes = nullptr;
+  branches = nullptr;
+  names = nullptr;
+  pool  = nullptr;
+  mask  = 0;
+  bloom_mask = 0;
+  branch_mask = 0;
+  count = 0;
+  memset(&apex, 0, sizeof(apex));
+  memset(branch_lengths, 0, sizeof(branch_lengths));
+}
+
+const DNS_index::entry_t* DNS_index::find(const char* name, int length, uint32_t hash) const
+{
+  if (slots == nullptr) return nullptr;
+  
+  for (uint32_t idx = hash & mask; slots[idx].length; idx = (idx + 1) & mask)
+  {
+    const entry_t& entry = slots[idx];
+    if (entry.hash != hash || entry.length != length) continue;
+    
+    // both in lowercase, so no need to fold them again
+    if (memcmp(&names[entry.name], name, length) == 0) return &entry;
+  }
+  return nullptr;
+}
+
+bool DNS_index::encloses(const char* name, int length) const
+{
+  if (apex.length == 0 || length < apex.length) return false;
+  
+  // step down the labels to where the apex would start
+  int pos = 0;
+  while (length - pos > apex.length)
+    pos += 1 + (uint8_t) name[pos];
+  
+  return pos + apex.length == length &&
+         memcmp(&names[apex.name], name + pos, apex.length) == 0;
+}
+
+int DNS_index::soa(char* out, int outlen, int namelen, bool answer) const
+{
+  if (apex.length == 0) return 0;
+  
+  int additional;
+  int size = section(apex.data, out, outlen, namelen - apex.length, additional);
+  // past the owner, type and class
+  if (size && answer) put32(out + 6, apex.ttl);
+  return size;
+}
+
+int DNS_index::referral(const node_t& cut, char* out, int outlen, int namelen,
+                        int& additional) const
+{
+  return section(cut.data, out, outlen, namelen - cut.length, additional);
+}
+
+int DNS_index::section(uint32_t data, char* out, int outlen, int shift, int& additional) const
+{
+  const char* section = &pool[data];
+  int size    = get16(section);
+  int patches = get16(section + 4);
+  additional  = get16(section + 2);
+  if (size > outlen) return 0;
+  
+  const char* patch = section + 6;
+  memcpy(out, patch + 2 * patches, size);
+  
+  // the question is longer than the one it was built for by shift
+  // bytes, so is everything the pointers in it point at
+  for (int i = 0; i < patches; i++)
+  {
+    char* pointer = out + get16(patch + 2 * i);
+    put16(pointer, get16(pointer) + shift);
+  }
+  return size;
+}
+
+const DNS_index::node_t* DNS_index::descend(const char* name, int length, uint32_t hash,
+                                            match_t& match) const
+{
+  match = MATCH_NONE;
+  if (nodes == nullptr) return nullptr;
+  
+  // nothing to find down there unless a wildcard or cut hangs off the
+  // name or one of its suffixes, and mostly no suffix is even the right
+  // length, so few of them are ever hashed
+  bool branched = false;
+  for (int pos = 0; !branched; pos += 1 + (uint8_t) name[pos])
+  {
+    int len = length - pos;
+    if (branchLength(len))
+      branched = mayBranch(pos ? dns_lower_hash(name + pos, nullptr, len) : hash);
+    if (len == 1) break;
+  }
+  if (!branched) return nullptr;
+  
+  // where each label starts, to go through them from the last
+  int starts[DNS_LABELS_MAX];
+  int labels = 0;
+  for (int pos = 0; pos < length - 1; pos += 1 + (uint8_t) name[pos])
+    starts[labels++] = pos;
+  
+  const node_t* node = &nodes[0];
+  while (labels > 0)
+  {
+    const node_t* next = child(*node, name + starts[labels - 1]);
+    if (next == nullptr) break;
+    node = next;
+    labels--;
+    
+    // nothing at or under a cut is ours to answer
+    if (node->flags & DNS_NODE_CUT)
+    {
+      match = MATCH_CUT;
+      return node;
+    }
+  }
+  // the name is there after all, or there is nothing to stand in for it
+  if (labels == 0 || !(node->flags & DNS_NODE_WILDCARD)) return nullptr;
+  
+  // the tree only has the way to the wildcards, so it takes the
+  // table to tell if there is a name between us and the wildcard,
+  // which would be the closer one, with no wildcard (RFC 4592)
+  const char* closer = name + starts[labels - 1];
+  uint32_t closehash;
+  int len = hashName(closer, name + length, closehash);
+  if (mayContain(closehash) && find(closer, len, closehash)) return nullptr;
+  
+  match = MATCH_WILDCARD;
+  return &nodes[node->children];
+}
+
+const DNS_index::node_t* DNS_index::child(const node_t& node, const char* label) const
+{
+  uint32_t first = node.children;
+  uint32_t end   = node.children + node.count;
+  int len = 1 + (uint8_t) label[0];
+  
+  // the wildcard is first, whatever its hash, and only ever
+  // matches a * in the name itself
+  if (node.flags & DNS_NODE_WILDCARD)
+  {
+    if (len == 2 && label[1] == '*') return &nodes[first];
+    first++;
+  }
+  
+  // a few are quicker to compare than to hash and search
+  if (end - first <= TREE_SCAN_MAX)
+  {
+    for (; first < end; first++)
+    {
+      if (memcmp(&names[nodes[first].label], label, len) == 0) return &nodes[first];
+    }
+    return nullptr;
+  }
+  
+  // the first of the children with this hash, if there are any
+  uint32_t hash = labelHash(label);
+  uint32_t last = end;
+  while (first < last)
+  {
+    uint32_t mid = first + (last - first) / 2;
+    if (nodes[mid].hash < hash) first = mid + 1;
+    else last = mid;
+  }
+  for (; first < end && nodes[first].hash == hash; first++)
+  {
+    if (memcmp(&names[nodes[first].label], label, len) == 0) return &nodes[first];
+  }
+  return nullptr;
+}
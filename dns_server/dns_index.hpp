@@ -0,0 +1,296 @@
+#ifndef DNS_INDEX_HPP
+#define DNS_INDEX_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+class DnsName;
+
+// Bloom filter bits per name in the index, 8 of them set for each,
+// so fewer than one in a thousand names not there get past it
+#define DNS_BLOOM_BITS_PER_NAME  16
+// words in a Bloom filter block
+#define DNS_BLOOM_WORDS           8
+// labels in a name at most, one byte each and the root
+#define DNS_LABELS_MAX          128
+// bits per name a wildcard or cut hangs off, in the filter in front of
+// the tree, 2 of them set for each, in the same 64-bit word
+#define DNS_BRANCH_BITS_PER_NAME 16
+
+// what a node in the tree of labels is
+#define DNS_NODE_DATA      1 // has answers
+#define DNS_NODE_CUT       2 // is delegated, and has a referral instead
+#define DNS_NODE_WILDCARD  4 // has a wildcard, its first child
+
+/**
+ * Flat name index for the query hot path
+ * 
+ * An open-addressing hash table over names in wire format
+ * (3www6google3com0), built once from the zone. Each slot holds the
+ * full hash next to the offsets of its name and its data, so a probe
+ * only touches the slot array until the hash matches, and then the
+ * one name it has to compare. Names are kept lowercase in one
+ * contiguous pool, and the data in another: for each name, its answer
+ * section exactly as it goes on the wire, with every owner name
+ * already compressed to point at the question. Answering is then
+ * one copy of those bytes.
+ * 
+ * In front of the table sits a Bloom filter over the names, split in
+ * 32-byte blocks (8 words, one bit set in each per name), so a name
+ * that isn't there is nearly always turned away by one small read,
+ * however large the zone is, and never gets to the table at all. For
+ * those names under the zone's apex, the SOA record that goes with
+ * the negative answer is kept ready as well, compressed against the
+ * question, so it costs one copy and a few adds.
+ * 
+ * Names that aren't in the table may still be answered for, from a
+ * wildcard (*.google.com), or with a referral, being at or below a
+ * zone cut (NS records for a name under the apex). For those, there
+ * is a tree of the labels, from the root down (com, google, www), in
+ * one array, where the children of a node are all together, sorted
+ * by the hash of their label, any wildcard first. One walk down it,
+ * a binary search on each level, finds the cut above a name, or the
+ * closest name above it that exists, and its wildcard. It is only
+ * built for zones with wildcards or cuts, and only walked for names
+ * the table doesn't have, so it costs nothing to any other query.
+ * Even those mostly never get to it: the names a wildcard or cut hangs
+ * off (google.com for *.google.com) are in a filter of their own, by
+ * length and then by hash, and a name none of whose suffixes gets
+ * through it can't be under any of them.
+ * That works because the table has every name there is: names at or
+ * below a cut are left out of it, and names only there for the names
+ * under them (google.com, when there is just www.google.com) are put
+ * in it, without any answers.
+ * 
+ * Everything is offsets, nothing is pointers, so the whole index can
+ * be written out as a zone image with save(), and served straight
+ * out of the file again with map(), however large it is.
+**/
+class DNS_index
+{
+public:
+  struct entry_t
+  {
+    uint32_t hash;
+    uint32_t name;   // offset into names
+    uint32_t data;   // offset into the data pool
+    uint16_t count;  // number of answer records
+    uint8_t  length; // of the name, 0 for an empty slot
+    uint8_t  reserved;
+  };
+  // a name in the tree of labels
+  struct node_t
+  {
+    uint32_t hash;     // of its label, what its siblings are sorted by
+    uint32_t label;    // offset into names, of its label
+    uint32_t children; // index of the first of its children
+    uint32_t count;    // of children
+    uint32_t data;     // offset into the data pool: answers, or a referral
+    uint16_t records;  // answers, or NS records in the referral
+    uint8_t  flags;    // DNS_NODE_*
+    uint8_t  length;   // of its whole name
+  };
+  // what descend() found
+  enum match_t
+  {
+    MATCH_NONE,
+    MATCH_WILDCARD, // the wildcard the name is answered from
+    MATCH_CUT,      // the zone cut the name is at or below
+  };
+  struct mapping_t
+  {
+    std::vector<uint32_t> addrs;
+    uint32_t ttl;
+    std::vector<std::string> nameservers; // dotted, if delegated
+    uint32_t ns_ttl;
+  };
+  // the zone's SOA record, dotted names (www.google.com.)
+  struct soa_t
+  {
+    std::string apex; // empty for no SOA
+    std::string mname;
+    std::string rname;
+    uint32_t serial, refresh, retry, expire, minimum;
+    uint32_t ttl;
+  };
+  // where the SOA record is, once built
+  struct apex_t
+  {
+    uint32_t name;   // offset into names
+    uint32_t data;   // offset into the data pool
+    uint32_t ttl;    // of the SOA, the record itself has the negative TTL
+    uint8_t  length; // of the apex, 0 for no SOA
+    uint8_t  reserved[3];
+  };
+  
+  DNS_index();
+  ~DNS_index();
+  DNS_index(const DNS_index&) = delete;
+  DNS_index& operator= (const DNS_index&) = delete;
+  
+  // (re)build from dotted names (www.google.com.) and their addresses,
+  // the SOA record, if soa.apex isn't empty, and the zone cuts, names
+  // other than the apex with nameservers
+  void build(const std::map<std::string, mapping_t>& table, const soa_t& soa);
+  
+  // write the index out as a zone image, returns false on failure
+  bool save(const std::string& path) const;
+  // use the zone image at path in place of whatever we had,
+  // returns false if it can't be mapped or isn't a zone image
+  bool map(const std::string& path);
+  
+  // check the uncompressed wire-format name at name, no further than end,
+  // and hash it, returns its length including the root label, or 0 if
+  // it is not a valid name; lower gets it in lowercase, unless nullptr
+  static int hashName(const char* name, const char* end, uint32_t& hash,
+                      char* lower = nullptr);
+  
+  // the entry for a name of length bytes with the given hash,
+  // or nullptr if we don't have it; name must be in lowercase,
+  // as hashName leaves it in lower
+  const entry_t* find(const char* name, int length, uint32_t hash) const;
+  // false if no name with this hash is in the index, true if it may be,
+  // which is worth checking before find() when most names are not there
+  bool mayContain(uint32_t hash) const
+  {
+    if (bloom == nullptr) return true;
+    
+    const uint32_t* block = &bloom[bloomBlock(hash)];
+    uint32_t missing = 0;
+    for (int i = 0; i < DNS_BLOOM_WORDS; i++)
+      missing |= ~block[i] & bloomBit(hash, i);
+    return missing == 0;
+  }
+  
+  // true if the lowercase name of length bytes is the apex, or under it
+  bool encloses(const char* name, int length) const;
+  // true if the lowercase name of length bytes is the apex
+  bool isApex(const char* name, int length) const
+  {
+    return apex.length && length == apex.length &&
+           memcmp(&names[apex.name], name, length) == 0;
+  }
+  // write the SOA record to out, for a response whose question is
+  // namelen bytes long and under the apex, with the SOA's own TTL as
+  // an answer, or the negative TTL to go in the authority section,
+  // returns its size, or 0 if there is no SOA or it needs more than
+  // outlen bytes
+  int soa(char* out, int outlen, int namelen, bool answer) const;
+  
+  // the wildcard for the lowercase name of length bytes and this hash,
+  // which find() doesn't have, or the zone cut it is at or below, with
+  // match saying which, or nullptr if there is neither
+  const node_t* descend(const char* name, int length, uint32_t hash, match_t& match) const;
+  // write the referral at cut (its NS records, then any addresses for
+  // them) to out, for a response whose question is namelen bytes long,
+  // returns its size, or 0 if it needs more than outlen bytes, and the
+  // addresses in additional
+  int referral(const node_t& cut, char* out, int outlen, int namelen,
+               int& additional) const;
+  
+  // the prebuilt answer records at data (of an entry or a node),
+  // and their size in bytes
+  const char* answers(uint32_t data, int& size) const
+  {
+    const unsigned char* bytes = (const unsigned char*) &pool[data];
+    size = bytes[0] << 8 | bytes[1];
+    return &pool[data + 2];
+  }
+  size_t size() const
+  {
+    return this->count;
+  }
+  
+private:
+  // where the Bloom block for a name with this hash starts, the table
+  // goes by the low bits of the hash, so the filter takes the high ones
+  uint32_t bloomBlock(uint32_t hash) const
+  {
+    return ((hash * 0x9e3779b97f4a7c15ull) >> 32 & bloom_mask) * DNS_BLOOM_WORDS;
+  }
+  // the bit it sets in word i of that block
+  static uint32_t bloomBit(uint32_t hash, int i)
+  {
+    static const uint32_t salts[DNS_BLOOM_WORDS] =
+    {
+      0x47b6137b, 0x44974d91, 0x8824ad5b, 0xa2b7289d,
+      0x705495c7, 0x2df1424b, 0x9efc4947, 0x5c6bfb31
+    };
+    return 1u << ((hash * salts[i]) >> 27);
+  }
+  
+  // false if no wildcard or cut hangs off any name of length bytes
+  bool branchLength(int length) const
+  {
+    return branch_lengths[length >> 6] >> (length & 63) & 1;
+  }
+  // false if no wildcard or cut hangs off the name with this hash,
+  // true if one may
+  bool mayBranch(uint32_t hash) const
+  {
+    uint64_t word = branches[(hash * 0x9e3779b97f4a7c15ull) >> 32 & branch_mask];
+    uint64_t bits = 1ull << (hash >> 26) | 1ull << (hash >> 20 & 63);
+    return (word & bits) == bits;
+  }
+  // the child of node with the lowercase label, or nullptr
+  const node_t* child(const node_t& node, const char* label) const;
+  // copy the prebuilt records at data to out, for a question shift bytes
+  // longer than the one they were built for, returns their size, or 0
+  // if they need more than outlen bytes, and how many are additional
+  int section(uint32_t data, char* out, int outlen, int shift, int& additional) const;
+  
+  void unmap();
+  // put answers or a section into the data pool, returns where
+  uint32_t addAnswers(const DnsName& name, const mapping_t& mapping);
+  uint32_t addSection(const char* records, int size, int additional,
+                      const std::vector<uint16_t>& patches);
+  void buildBloom();
+  void buildSOA(const soa_t& soa);
+  // the filter over the names (in wire format, lowercase) that
+  // wildcards and cuts hang off
+  void buildBranches(const std::vector<std::string>& names);
+  // the tree over names (in wire format, lowercase), of which owners
+  // have records and cuts are delegated, whose answers are in answers
+  void buildTree(const std::map<std::string, const mapping_t*>& owners,
+                 const std::set<std::string>& cuts,
+                 const std::vector<std::string>& names,
+                 const std::map<std::string, uint32_t>& answers);
+  // the referral to the nameservers of cut, and how many there are
+  uint32_t buildReferral(const std::string& cut, const mapping_t& mapping,
+                         const std::map<std::string, const mapping_t*>& owners,
+                         uint16_t& records);
+  
+  // what we answer from, either built or mapped
+  const entry_t*  slots;
+  const uint32_t* bloom; // blocks of 8 words
+  const node_t*   nodes; // the root first, nullptr for no tree
+  const uint64_t* branches; // while there is a tree
+  const char*     names;
+  const char*     pool;
+  uint32_t mask;
+  uint32_t bloom_mask;  // blocks, less one
+  uint32_t branch_mask; // words, less one
+  size_t   count;
+  apex_t   apex;
+  // bit n is set if a wildcard or cut hangs off a name n bytes long
+  uint64_t branch_lengths[4];
+  
+  // storage when built
+  std::vector<entry_t>  slot_store;
+  std::vector<uint32_t> bloom_store;
+  std::vector<uint64_t> branch_store;
+  std::vector<node_t>   node_store;
+  std::vector<char>     name_store;
+  std::vector<char>     pool_store;
+  
+  // the zone image when mapped
+  void*  mapping;
+  size_t mapsize;
+};
+
+#endif
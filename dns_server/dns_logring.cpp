@@ -0,0 +1,102 @@
+#include "dns_logring.hpp"
+#include "dns_wire.hpp"
+#include "../src/dns.hpp"
+
+#include <stdio.h>
+#include <time.h>
+
+void dns_log_response(dns_log_record_t& rec, const char* packet, int len)
+{
+  const dns_header_t& hdr = *(const dns_header_t*) packet;
+  rec.rcode   = hdr.rcode;
+  rec.flags   = hdr.tc ? DNS_LOG_TRUNCATED : 0;
+  rec.namelen = 0;
+  rec.qtype   = 0;
+  rec.reserved = 0;
+  
+  if (get16((const char*) &hdr.q_count) != 1) return;
+  
+  // the question comes first, and is never compressed
+  const char* qname = packet + sizeof(dns_header_t);
+  int remaining = len - sizeof(dns_header_t);
+  int namelen = 0;
+  
+  while (true)
+  {
+    if (namelen >= remaining) return;
+    uint8_t label = qname[namelen];
+    if (label > 63) return;
+    
+    namelen += 1 + label;
+    if (namelen > DNS_WIRE_NAME_MAX) return;
+    if (label == 0) break;
+  }
+  if (namelen + 2 > remaining) return;
+  
+  memcpy(rec.name, qname, namelen);
+  rec.namelen = namelen;
+  rec.qtype   = get16(qname + namelen);
+}
+
+static const char* typeName(uint16_t qtype)
+{
+  switch (qtype)
+  {
+  case DNS_TYPE_A:     return "A";
+  case DNS_TYPE_NS:    return "NS";
+  case DNS_TYPE_CNAME: return "CNAME";
+  case DNS_TYPE_SOA:   return "SOA";
+  case DNS_TYPE_PTR:   return "PTR";
+  case DNS_TYPE_MX:    return "MX";
+  case DNS_TYPE_TXT:   return "TXT";
+  case DNS_TYPE_AAAA:  return "AAAA";
+  case DNS_TYPE_SRV:   return "SRV";
+  case DNS_TYPE_ANY:   return "ANY";
+  }
+  return nullptr;
+}
+
+static const char* rcodeName(uint8_t rcode)
+{
+  static const char* names[] =
+  {
+    "NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED"
+  };
+  return (rcode < sizeof(names) / sizeof(names[0])) ? names[rcode] : nullptr;
+}
+
+int dns_log_format(const dns_log_record_t& rec, char* out, int outlen)
+{
+  char when[40] = "-";
+  if (rec.time_ns)
+  {
+    time_t secs = rec.time_ns / 1000000000;
+    tm utc;
+    gmtime_r(&secs, &utc);
+    int len = strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &utc);
+    snprintf(when + len, sizeof(when) - len, ".%06uZ",
+             (unsigned) (rec.time_ns % 1000000000 / 1000));
+  }
+  
+  char name[DNS_NAME_MAX] = "-";
+  DnsName qname;
+  if (rec.namelen && qname.read(rec.name, rec.namelen, 0) > 0)
+    qname.toText(name, sizeof(name));
+  
+  char qtype[16], rcode[16];
+  const char* type = typeName(rec.qtype);
+  if (type == nullptr)
+    snprintf(qtype, sizeof(qtype), "TYPE%u", rec.qtype);
+  const char* code = rcodeName(rec.rcode);
+  if (code == nullptr)
+    snprintf(rcode, sizeof(rcode), "RCODE%u", rec.rcode);
+  
+  const unsigned char* ip = (const unsigned char*) &rec.client;
+  int len = snprintf(out, outlen, "%s %u.%u.%u.%u#%u %s %s %s %uus%s%s",
+                     when, ip[0], ip[1], ip[2], ip[3], get16((const char*) &rec.port),
+                     name, type ? type : qtype, code ? code : rcode,
+                     rec.latency_ns / 1000,
+                     (rec.flags & DNS_LOG_TRUNCATED) ? " truncated" : "",
+                     (rec.flags & DNS_LOG_FORWARDED) ? " forwarded" : "");
+  return (len < outlen) ? len : -1;
+}
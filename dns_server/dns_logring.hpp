@@ -0,0 +1,123 @@
+#ifndef DNS_LOGRING_HPP
+#define DNS_LOGRING_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+
+#include "../src/dns_name.hpp"
+
+// records a ring holds, a power of two
+#define DNS_LOG_RING       4096
+// keeps what the writer and the reader of a ring touch apart
+#define DNS_LOG_CACHE_LINE   64
+
+// what else there is to know about a query
+#define DNS_LOG_TRUNCATED  0x01 // the response was, to fit in UDP
+#define DNS_LOG_FORWARDED  0x02 // answered from upstream
+
+/**
+ * One query and how it was answered, as logged
+ *
+ * In a log file every record is written as far as the end of its
+ * name, in the byte order of the machine that wrote it. Times are 0
+ * where there is no clock to read them from.
+**/
+struct dns_log_record_t
+{
+  uint64_t time_ns;     // wall clock, when the query arrived
+  uint32_t latency_ns;  // from then until the response was sent
+  uint32_t client;      // IPv4 address, network byte order
+  uint16_t port;        // network byte order
+  uint16_t qtype;
+  uint8_t  rcode;
+  uint8_t  flags;       // DNS_LOG_*
+  uint8_t  namelen;     // bytes of name, 0 for a response without a question
+  uint8_t  reserved;
+  char     name[DNS_WIRE_NAME_MAX]; // as it was asked, in wire format
+  
+  // bytes of the record up to the end of its name
+  int size() const
+  {
+    return offsetof(dns_log_record_t, name) + namelen;
+  }
+};
+
+// take the question, rcode and flags from the response of len bytes in packet
+void dns_log_response(dns_log_record_t& rec, const char* packet, int len);
+// a record as one line of text, without the newline, returns its
+// length, or -1 if it doesn't fit in outlen bytes
+int  dns_log_format(const dns_log_record_t& rec, char* out, int outlen);
+
+/**
+ * Query log records on their way from the one thread that logs them
+ * to the one thread that writes them out
+ *
+ * A fixed ring of records, written in place, so logging a query takes
+ * no lock, no allocation and no system call. When the writer can't
+ * keep up and the ring is full, records are dropped, for the thread
+ * logging them to count, and it never waits.
+**/
+class DNS_logring
+{
+public:
+  explicit DNS_logring(int size = DNS_LOG_RING)
+    : slots(new dns_log_record_t[size]), mask(size - 1),
+      head(0), tail_seen(0), tail(0) {}
+  
+  DNS_logring(const DNS_logring&) = delete;
+  DNS_logring& operator=(const DNS_logring&) = delete;
+  
+  // the next record to fill in, or nullptr if the ring is full,
+  // then commit() it
+  dns_log_record_t* reserve()
+  {
+    uint32_t pos = head.load(std::memory_order_relaxed);
+    if (pos - tail_seen > mask)
+    {
+      tail_seen = tail.load(std::memory_order_acquire);
+      if (pos - tail_seen > mask)
+        return nullptr;
+    }
+    return &slots[pos & mask];
+  }
+  void commit()
+  {
+    head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+  
+  // records waiting to be written
+  uint32_t size() const
+  {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+  }
+  // hand each record waiting to write, up to max of them, returns how many
+  template <typename Writer>
+  int drain(Writer write, int max)
+  {
+    uint32_t pos = tail.load(std::memory_order_relaxed);
+    uint32_t end = head.load(std::memory_order_acquire);
+    int count = 0;
+    
+    for (; pos != end && count < max; pos++, count++)
+      write(slots[pos & mask]);
+    // only now may the slots be filled in again
+    tail.store(pos, std::memory_order_release);
+    return count;
+  }
+
+private:
+  std::unique_ptr<dns_log_record_t[]> slots;
+  uint32_t mask;
+  
+  // the logging thread's
+  std::atomic<uint32_t> head;
+  uint32_t tail_seen; // tail as of when it was last read
+  char pad[DNS_LOG_CACHE_LINE];
+  // the writing thread's
+  std::atomic<uint32_t> tail;
+};
+
+#endif
@@ -0,0 +1,149 @@
+#include "dns_querylog.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace std;
+
+DNS_querylog::DNS_querylog(const std::string& path, size_t max_bytes, int keep)
+  : path(path), max_bytes(max_bytes), keep(max(keep, 1)),
+    fd(-1), written(0), buffer(DNS_LOG_BUFSIZE), buffered(0), running(false) {}
+
+DNS_querylog::~DNS_querylog()
+{
+  stop();
+}
+
+DNS_logring* DNS_querylog::ring()
+{
+  rings.emplace_back(new DNS_logring);
+  return rings.back().get();
+}
+
+bool DNS_querylog::start()
+{
+  if (!open()) return false;
+  
+  running = true;
+  thread = std::thread([this] { run(); });
+  return true;
+}
+
+void DNS_querylog::stop()
+{
+  running = false;
+  if (thread.joinable()) thread.join();
+  if (fd < 0) return;
+  
+  // whoever logs into the rings has stopped by now
+  while (drain() > 0);
+  flush();
+  close(fd);
+  fd = -1;
+}
+
+void DNS_querylog::run()
+{
+  while (running)
+  {
+    // a busy server keeps us draining, and once we have
+    // caught up, what we have goes out to the file
+    if (drain() == 0)
+    {
+      flush();
+      this_thread::sleep_for(chrono::milliseconds(DNS_LOG_DRAIN_MS));
+    }
+  }
+}
+
+int DNS_querylog::drain()
+{
+  int total = 0;
+  for (auto& ring : rings)
+  {
+    total += ring->drain(
+    [this] (const dns_log_record_t& rec)
+    {
+      int size = rec.size();
+      // whatever fits in the file goes there before it is rotated
+      if (buffered + size > buffer.size() || written + buffered + size > max_bytes)
+        flush();
+      
+      memcpy(buffer.data() + buffered, &rec, size);
+      buffered += size;
+    }, buffer.size() / sizeof(dns_log_record_t));
+  }
+  return total;
+}
+
+void DNS_querylog::flush()
+{
+  if (buffered == 0) return;
+  
+  // a file is only ever rotated between writes, so
+  // it always ends where a record does
+  if (written + buffered > max_bytes && written > sizeof(uint32_t))
+    rotate();
+  if (fd < 0)
+  {
+    buffered = 0;
+    return;
+  }
+  
+  size_t done = 0;
+  while (done < buffered)
+  {
+    ssize_t res = write(fd, buffer.data() + done, buffered - done);
+    if (res < 0 && errno == EINTR) continue;
+    if (res <= 0)
+    {
+      cout << "<DNS QUERYLOG> " << path << ": " << strerror(errno) << endl;
+      break;
+    }
+    done += res;
+  }
+  written  += done;
+  buffered  = 0;
+}
+
+bool DNS_querylog::open()
+{
+  fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+  {
+    cout << "<DNS QUERYLOG> " << path << ": " << strerror(errno) << endl;
+    return false;
+  }
+  uint32_t magic = DNS_LOG_MAGIC;
+  if (write(fd, &magic, sizeof(magic)) != sizeof(magic))
+  {
+    cout << "<DNS QUERYLOG> " << path << ": " << strerror(errno) << endl;
+    close(fd);
+    fd = -1;
+    return false;
+  }
+  written = sizeof(magic);
+  return true;
+}
+
+void DNS_querylog::rotate()
+{
+  close(fd);
+  fd = -1;
+  
+  // path.N falls off the end, everything else moves up one
+  for (int i = keep - 1; i >= 1; i--)
+  {
+    string from = path + "." + to_string(i);
+    string to   = path + "." + to_string(i + 1);
+    rename(from.c_str(), to.c_str());
+  }
+  rename(path.c_str(), (path + ".1").c_str());
+  open();
+}
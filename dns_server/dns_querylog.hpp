@@ -0,0 +1,73 @@
+#ifndef DNS_QUERYLOG_HPP
+#define DNS_QUERYLOG_HPP
+
+#include "dns_logring.hpp"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// how often the writer drains the rings once it has caught up, a ring
+// holds as many queries as a worker answers in this long at 800k/s
+#define DNS_LOG_DRAIN_MS     5
+// bytes collected before they go to the file in one write
+#define DNS_LOG_BUFSIZE    (256 * 1024)
+// a log file is rotated once it grows past this
+#define DNS_LOG_MAX_BYTES  (64 << 20)
+// rotated files kept, as path.1 (the newest) to path.N
+#define DNS_LOG_KEEP       4
+// the first four bytes of every log file ("QLG1" written on a little-endian
+// machine), which also tells a reader whether it shares the writer's byte order
+#define DNS_LOG_MAGIC      0x31474c51
+
+/**
+ * Writes the queries the server answers to a binary log file
+ *
+ * Each thread that answers queries logs them into a ring of its own
+ * (see DNS_logring), and a thread of our own drains all the rings into
+ * the file, many records to a write(). The file starts with
+ * DNS_LOG_MAGIC, and then holds one dns_log_record_t after another, each
+ * as far as the end of its name. Once it grows past its limit, it is
+ * renamed to path.1 (and path.1 to path.2, and so on), and a new one is
+ * started. dns_logcat turns log files back into text.
+**/
+class DNS_querylog
+{
+public:
+  DNS_querylog(const std::string& path,
+               size_t max_bytes = DNS_LOG_MAX_BYTES, int keep = DNS_LOG_KEEP);
+  ~DNS_querylog();
+  
+  // a ring for one more thread to log into, before start()
+  DNS_logring* ring();
+  
+  // open the log, returns false if it can't be written
+  bool start();
+  // write out what is left in the rings, and close the log
+  void stop();
+
+private:
+  void run();
+  // take what is in every ring into the buffer, returns how many records
+  int  drain();
+  void flush();
+  bool open();
+  void rotate();
+  
+  std::string path;
+  size_t max_bytes;
+  int keep;
+  std::vector<std::unique_ptr<DNS_logring>> rings;
+  
+  int fd;
+  size_t written; // to the file as it is
+  std::vector<char> buffer;
+  size_t buffered;
+  
+  std::thread thread;
+  std::atomic<bool> running;
+};
+
+#endif
@@ -0,0 +1,131 @@
+#include "dns_ratelimit.hpp"
+#include "dns_wire.hpp"
+#include "../src/dns.hpp"
+
+#include <algorithm>
+#include <arpa/inet.h>
+
+// a bucket is a tag from its key, when it was last filled (in ms,
+// wrapping), and its tokens (in thousandths of a response)
+#define TAG_BITS     20
+#define STAMP_BITS   24
+#define TOKEN_BITS   20
+#define STAMP_MASK   ((1u << STAMP_BITS) - 1)
+#define TOKEN_MASK   ((1u << TOKEN_BITS) - 1)
+// tokens one response takes
+#define TOKEN_COST   1000
+
+// the sorts of response that are limited apart
+enum kind_t
+{
+  KIND_ANSWER = 1, // by name and type
+  KIND_NODATA,     // by name and type
+  KIND_NXDOMAIN,   // whatever the name
+  KIND_ERROR,      // whatever the name
+};
+
+static inline uint64_t mix(uint64_t h)
+{
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdull;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ull;
+  return h ^ (h >> 33);
+}
+
+DNS_ratelimit::DNS_ratelimit(int rate, int slip, int table_bits)
+  : table(new std::atomic<uint64_t>[1ull << table_bits]),
+    mask((1ull << table_bits) - 1),
+    rate(std::max(1, std::min(rate, DNS_RRL_MAX_RATE))),
+    slip(std::max(slip, 0))
+{
+  for (uint64_t i = 0; i <= mask; i++)
+    table[i].store(0, std::memory_order_relaxed);
+}
+
+uint64_t DNS_ratelimit::key(uint32_t client, const char* packet, int len) const
+{
+  const dns_header_t& hdr = *(const dns_header_t*) packet;
+  uint32_t prefix = ntohl(client) & ~((1u << (32 - DNS_RRL_PREFIX_BITS)) - 1);
+  
+  uint64_t kind;
+  if (hdr.rcode == NAME_ERROR)
+    kind = KIND_NXDOMAIN;
+  else if (hdr.rcode != NO_ERROR)
+    kind = KIND_ERROR;
+  else
+    kind = hdr.ans_count ? KIND_ANSWER : KIND_NODATA;
+  
+  uint64_t k = (uint64_t) prefix << 32 | kind << 16;
+  if (kind == KIND_NXDOMAIN || kind == KIND_ERROR ||
+      get16((const char*) &hdr.q_count) != 1)
+    return mix(k);
+  
+  // the name, whatever its case, and the type asked for
+  const char* qname = packet + sizeof(dns_header_t);
+  const char* end   = packet + len;
+  uint32_t hash;
+  int namelen = DnsName::hashWire(qname, end, hash);
+  if (namelen == 0 || qname + namelen + 2 > end)
+    return mix(k);
+  
+  k |= get16(qname + namelen);
+  return mix(k ^ (uint64_t) hash << 8);
+}
+
+dns_rrl_verdict_t DNS_ratelimit::check(uint32_t client, const char* packet, int len,
+                                       uint64_t now_ms, uint32_t& limited)
+{
+  uint64_t h = key(client, packet, len);
+  std::atomic<uint64_t>& bucket = table[h & mask];
+  
+  uint64_t tag   = h >> (64 - TAG_BITS);
+  uint32_t stamp = now_ms & STAMP_MASK;
+  uint32_t full  = rate * TOKEN_COST;
+  
+  uint64_t old = bucket.load(std::memory_order_relaxed);
+  bool allowed;
+  while (true)
+  {
+    // a bucket of our own fills up with the time since it was
+    // last seen, one of someone else's is taken over, full
+    uint64_t tokens = full;
+    if ((old >> (64 - TAG_BITS)) == tag)
+    {
+      uint64_t elapsed = (stamp - (old >> TOKEN_BITS)) & STAMP_MASK;
+      tokens = std::min<uint64_t>(full, (old & TOKEN_MASK) + elapsed * rate);
+    }
+    allowed = tokens >= TOKEN_COST;
+    if (allowed) tokens -= TOKEN_COST;
+    
+    uint64_t bucketed = tag << (64 - TAG_BITS) | (uint64_t) stamp << TOKEN_BITS | tokens;
+    if (bucket.compare_exchange_weak(old, bucketed, std::memory_order_relaxed))
+      break;
+  }
+  if (allowed) return DNS_RRL_SEND;
+  
+  limited++;
+  return (slip && limited % slip == 0) ? DNS_RRL_TRUNCATE : DNS_RRL_DROP;
+}
+
+int DNS_ratelimit::truncate(char* packet, int len)
+{
+  dns_header_t& hdr = *(dns_header_t*) packet;
+  int end = sizeof(dns_header_t);
+  
+  uint32_t hash;
+  if (get16((const char*) &hdr.q_count) == 1)
+  {
+    int namelen = DnsName::hashWire(packet + end, packet + len, hash);
+    if (namelen && end + namelen + (int) sizeof(dns_question_t) <= len)
+      end += namelen + sizeof(dns_question_t);
+  }
+  if (end == (int) sizeof(dns_header_t))
+    hdr.q_count = 0;
+  
+  hdr.tc = 1;
+  hdr.ans_count  = 0;
+  hdr.auth_count = 0;
+  hdr.add_count  = 0;
+  return end;
+}
@@ -0,0 +1,71 @@
+#ifndef DNS_RATELIMIT_HPP
+#define DNS_RATELIMIT_HPP
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+
+// responses a second of one kind to one client prefix, by default
+#define DNS_RRL_RATE         20
+// every this many limited responses, one goes out truncated (0 for none)
+#define DNS_RRL_SLIP          2
+// clients in the same /24 share their limits
+#define DNS_RRL_PREFIX_BITS  24
+// buckets in the table, as a power of two, of 8 bytes each
+#define DNS_RRL_TABLE_BITS   18
+// the most responses a second a bucket can be set to
+#define DNS_RRL_MAX_RATE   1000
+
+// what to do with a response
+enum dns_rrl_verdict_t
+{
+  DNS_RRL_SEND = 0,
+  DNS_RRL_DROP,
+  DNS_RRL_TRUNCATE, // send it truncated, so a real client asks again over TCP
+};
+
+/**
+ * Response rate limiting (RRL), against reflection and floods
+ *
+ * Responses are sorted by who they go to (the client's /24) and what
+ * they are: answers and empty answers for a name and type, NXDOMAIN
+ * for any name, and errors. Each sort gets a token bucket that fills
+ * at the rate, up to a second's worth, and every response takes a
+ * token from it; once it is empty, responses are dropped, except every
+ * slip-th, which goes out truncated so a real client behind a spoofed
+ * flood still gets through over TCP.
+ *
+ * The buckets live in a table of fixed size, one 64-bit word each (a
+ * tag from the key, when it was last filled, and the tokens), updated
+ * with a compare and swap, so any number of threads share it without
+ * locks, and a response costs a hash and one word however hard we are
+ * being flooded. A key that lands on a bucket with another tag takes
+ * it over with a full bucket: collisions fail open.
+**/
+class DNS_ratelimit
+{
+public:
+  DNS_ratelimit(int rate = DNS_RRL_RATE, int slip = DNS_RRL_SLIP,
+                int table_bits = DNS_RRL_TABLE_BITS);
+  
+  // what to do with the response of len bytes in packet, to the IPv4
+  // address client (network byte order), at now_ms on a steady clock;
+  // limited counts the responses the caller has had limited, for slip
+  dns_rrl_verdict_t check(uint32_t client, const char* packet, int len,
+                          uint64_t now_ms, uint32_t& limited);
+  
+  // cut the response of len bytes in packet down to its question, with
+  // TC set, returns its new length
+  static int truncate(char* packet, int len);
+
+private:
+  uint64_t key(uint32_t client, const char* packet, int len) const;
+  
+  std::unique_ptr<std::atomic<uint64_t>[]> table;
+  uint64_t mask;
+  uint32_t rate;
+  uint32_t slip;
+};
+
+#endif
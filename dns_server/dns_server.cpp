@@ -7,6 +7,7 @@ void DNS_server::start(Inet* net)
 {
   cout << "Starting DNS server on port " << DNS::DNS_SERVICE_PORT << ".." << endl;
   this->network = net;
+  zone.build();
   
   auto del(upstream::from<DNS_server, &DNS_server::listener>(this));
   net->udp_listen(DNS::DNS_SERVICE_PORT, del);
@@ -24,19 +25,12 @@ unsigned short ntohs(unsigned short sh)
 
 int DNS_server::listener(std::shared_ptr<net::Packet>& pckt)
 {
-  cout << "<DNS SERVER> got packet..." << endl;
-  
   DNS::full_header* full_hdr = (DNS::full_header*)pckt->buffer();
   DNS::header& hdr = full_hdr->dns_header;
   
-  int packetlen = DNS::createResponse(hdr,
-  [this] (const std::string& name) ->
-  std::vector<IP4::addr>*
-  {
-    auto it = lookup.find(name);
-    if (it == lookup.end()) return nullptr;
-    return &lookup[name];
-  });
+  int querylen = pckt->len() - sizeof(UDP::full_header);
+  int packetlen = zone.createResponse((char*) &hdr, querylen, DNS_UDP_MAX);
+  if (packetlen == 0) return 0;
   
   // send response back to client
   UDP::full_header& udp = full_hdr->full_udp_header;
@@ -44,7 +38,7 @@ int DNS_server::listener(std::shared_ptr<net::Packet>& pckt)
   // set source & return address
   udp.udp_hdr.dport = udp.udp_hdr.sport;
   udp.udp_hdr.sport = htons(DNS::DNS_SERVICE_PORT);
-  udp.udp_hdr.length = htons(sizeof(DNS::full_header) + packetlen);
+  udp.udp_hdr.length = htons(sizeof(udp.udp_hdr) + packetlen);
   
   // Populate outgoing IP header
   udp.ip_hdr.daddr = udp.ip_hdr.saddr;
@@ -55,10 +49,34 @@ int DNS_server::listener(std::shared_ptr<net::Packet>& pckt)
   int res = pckt->set_len(sizeof(UDP::full_header) + packetlen); 
   if(!res)
     cout << "<DNS_SERVER> ERROR setting packet length failed" << endl;
-  std::cout << "Returning " << packetlen << "b to " << udp.ip_hdr.daddr.str() << std::endl;  
-  std::cout << "Full packet size: " << pckt->len() << endl;
+  
+  // log it while the response is still ours, there is no clock to time it with
+  dns_log_record_t* rec = log.reserve();
+  if (rec)
+  {
+    dns_log_response(*rec, (char*) &hdr, packetlen);
+    rec->time_ns    = 0;
+    rec->latency_ns = 0;
+    rec->client     = udp.ip_hdr.daddr.whole;
+    rec->port       = udp.udp_hdr.dport;
+    log.commit();
+  }
+  
   // return packet (as DNS response)
   network->udp_send(pckt);
   
+  if (log.size() >= DNS_SERVER_LOG_BATCH) flushLog();
   return 0;
 }
+
+void DNS_server::flushLog()
+{
+  char line[512];
+  log.drain(
+  [&line] (const dns_log_record_t& rec)
+  {
+    if (dns_log_format(rec, line, sizeof(line)) > 0)
+      cout << "<DNS SERVER> " << line << '\n';
+  }, DNS_SERVER_LOG_BATCH);
+  cout << flush;
+}
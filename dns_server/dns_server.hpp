@@ -6,23 +6,43 @@
 
 #include <string>
 #include <vector>
-#include <map>
+
+#include "dns_zone.hpp"
+#include "dns_logring.hpp"
+
+// queries logged before they are written out together
+#define DNS_SERVER_LOG_BATCH 64
 
 class DNS_server
 {
 public:
+  DNS_server() : log(DNS_SERVER_LOG_BATCH * 2) {}
+  
   void addMapping(const std::string& key, std::vector<net::IP4::addr> values)
   {
-    lookup[key] = values;
+    DNS_zone::addr_list addrs;
+    for (auto& addr : values)
+      addrs.push_back(addr.whole);
+    
+    zone.addMapping(key, addrs);
+  }
+  DNS_zone& getZone()
+  {
+    return zone;
   }
   
   void start(net::Inet*);
   int listener(std::shared_ptr<net::Packet>&);
   
 private:
-  net::Inet* network;
-  std::map<std::string, std::vector<net::IP4::addr>> lookup;
+  // write out the queries logged so far
+  void flushLog();
   
+  net::Inet* network;
+  DNS_zone zone;
+  // there is no thread to write the log, so the
+  // listener writes it itself, a batch at a time
+  DNS_logring log;
 };
   
 #endif
@@ -0,0 +1,39 @@
+#include "dns_snapshot.hpp"
+
+#include <chrono>
+#include <thread>
+
+DNS_snapshot::DNS_snapshot(int readers, std::unique_ptr<DNS_zone> zone)
+  : current(zone.release()), epoch(1),
+    slots(new slot_t[readers]), readers(readers)
+{
+  for (int i = 0; i < readers; i++)
+    slots[i].epoch = 0;
+}
+
+DNS_snapshot::~DNS_snapshot()
+{
+  delete current.load();
+}
+
+void DNS_snapshot::publish(std::unique_ptr<DNS_zone> zone)
+{
+  std::lock_guard<std::mutex> guard(publishing);
+  
+  // from here on, new readers only ever see the new zone
+  DNS_zone* old = current.exchange(zone.release());
+  uint64_t  now = epoch.fetch_add(1) + 1;
+  
+  // wait out everyone who may have loaded the old one
+  for (int i = 0; i < readers; i++)
+  {
+    for (;;)
+    {
+      uint64_t seen = slots[i].epoch.load();
+      if (seen == 0 || seen >= now) break;
+      
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+  delete old;
+}
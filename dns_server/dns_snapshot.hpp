@@ -0,0 +1,61 @@
+#ifndef DNS_SNAPSHOT_HPP
+#define DNS_SNAPSHOT_HPP
+
+#include "dns_zone.hpp"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+/**
+ * Publishes immutable zone snapshots to query workers
+ * 
+ * Readers never block and never take a lock: enter() stamps the
+ * reader's slot with the current epoch and loads the zone, leave()
+ * clears the slot again. publish() swaps in the new zone, moves the
+ * epoch forward, and then waits until every reader is either outside
+ * or has entered after the swap before it deletes the old zone
+ * (epoch-based reclamation). Only the publisher ever waits.
+ * 
+ * A reader must leave() before it blocks (eg. in recvmmsg), or it
+ * will hold back every publish() in the meantime.
+**/
+class DNS_snapshot
+{
+public:
+  // readers start out seeing zone, which must be built
+  DNS_snapshot(int readers, std::unique_ptr<DNS_zone> zone);
+  ~DNS_snapshot();
+  
+  // the zone to answer from, until leave()
+  const DNS_zone* enter(int reader)
+  {
+    slots[reader].epoch.store(epoch.load());
+    return current.load();
+  }
+  void leave(int reader)
+  {
+    slots[reader].epoch.store(0, std::memory_order_release);
+  }
+  
+  // replace the zone readers see with zone (which must be built),
+  // returns once the previous zone has been deleted
+  void publish(std::unique_ptr<DNS_zone> zone);
+  
+private:
+  // one per reader, padded so readers don't share cache lines
+  struct slot_t
+  {
+    std::atomic<uint64_t> epoch; // 0 when outside
+    char padding[64 - sizeof(std::atomic<uint64_t>)];
+  };
+  
+  std::atomic<DNS_zone*> current;
+  std::atomic<uint64_t>  epoch;
+  std::unique_ptr<slot_t[]> slots;
+  int readers;
+  
+  std::mutex publishing; // one publisher at a time
+};
+
+#endif
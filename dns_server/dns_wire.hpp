@@ -0,0 +1,27 @@
+#ifndef DNS_WIRE_HPP
+#define DNS_WIRE_HPP
+
+#include <stdint.h>
+
+// everything on the wire is big-endian
+static inline uint16_t get16(const char* p)
+{
+  const unsigned char* u = (const unsigned char*) p;
+  return u[0] << 8 | u[1];
+}
+static inline uint32_t get32(const char* p)
+{
+  return (uint32_t) get16(p) << 16 | get16(p + 2);
+}
+static inline void put16(char* p, uint16_t val)
+{
+  p[0] = val >> 8;
+  p[1] = val & 0xff;
+}
+static inline void put32(char* p, uint32_t val)
+{
+  put16(p, val >> 16);
+  put16(p + 2, val & 0xffff);
+}
+
+#endif
@@ -0,0 +1,229 @@
+#include "dns_zone.hpp"
+#include "dns_wire.hpp"
+#include "../src/dns.hpp"
+
+#include <ctype.h>
+
+static std::string lowercase(const std::string& name)
+{
+  std::string result(name);
+  for (auto& c : result)
+    c = tolower((unsigned char) c);
+  return result;
+}
+
+void DNS_zone::addMapping(const std::string& key, const addr_list& values, uint32_t ttl)
+{
+  loaded = false;
+  DNS_index::mapping_t& mapping = table[lowercase(key)];
+  mapping.addrs = values;
+  mapping.ttl   = ttl;
+}
+
+void DNS_zone::addAddress(const std::string& key, uint32_t addr, uint32_t ttl)
+{
+  loaded = false;
+  auto it = table.find(lowercase(key));
+  if (it == table.end())
+  {
+    addMapping(key, addr_list(1, addr), ttl);
+    return;
+  }
+  // an RRset has the one TTL
+  if (it->second.addrs.empty() || ttl < it->second.ttl) it->second.ttl = ttl;
+  it->second.addrs.push_back(addr);
+}
+
+void DNS_zone::addNameserver(const std::string& key, const std::string& server, uint32_t ttl)
+{
+  loaded = false;
+  DNS_index::mapping_t& mapping = table[lowercase(key)];
+  if (mapping.nameservers.empty() || ttl < mapping.ns_ttl) mapping.ns_ttl = ttl;
+  mapping.nameservers.push_back(lowercase(server));
+}
+
+void DNS_zone::setSOA(const DNS_index::soa_t& soa)
+{
+  loaded = false;
+  this->soa = soa;
+  this->soa.apex = lowercase(soa.apex);
+}
+
+const DNS_zone::addr_list* DNS_zone::lookup(const std::string& name) const
+{
+  auto it = table.find(lowercase(name));
+  if (it == table.end()) return nullptr;
+  return &it->second.addrs;
+}
+
+bool DNS_zone::contains(const char* buffer, int len) const
+{
+  if (len < (int) sizeof(dns_header_t)) return true;
+  
+  const char* qname = buffer + sizeof(dns_header_t);
+  char lower[DNS_WIRE_NAME_MAX];
+  uint32_t hash;
+  
+  int namelen = DNS_index::hashName(qname, buffer + len, hash, lower);
+  if (namelen == 0) return true;
+  
+  // the zone answers for everything under its apex, there or not,
+  // and for what its wildcards and cuts cover
+  if (find(lower, namelen, hash) != nullptr || index.encloses(lower, namelen))
+    return true;
+  DNS_index::match_t match;
+  return index.descend(lower, namelen, hash, match) != nullptr;
+}
+
+int DNS_zone::createResponse(char* buffer, int len, int maxlen) const
+{
+  if (len < (int) sizeof(dns_header_t)) return 0;
+  dns_header_t& hdr = *(dns_header_t*) buffer;
+  
+  // never answer a response
+  if (hdr.qr != DNS_QR_QUERY) return 0;
+  
+  hdr.qr = DNS_QR_RESPONSE;
+  hdr.aa = 1; // authoritah
+  hdr.tc = DNS_TC_NONE;
+  hdr.ra = 0;
+  hdr.z  = DNS_Z_RESERVED;
+  hdr.ad = 0;
+  hdr.cd = 0;
+  hdr.ans_count  = 0;
+  hdr.auth_count = 0;
+  hdr.add_count  = 0;
+  
+  if (hdr.opcode != 0)
+  {
+    hdr.rcode = NOT_IMPL;
+    hdr.q_count = 0;
+    return sizeof(dns_header_t);
+  }
+  if (get16((char*) &hdr.q_count) != 1)
+  {
+    hdr.rcode = FORMAT_ERROR;
+    hdr.q_count = 0;
+    return sizeof(dns_header_t);
+  }
+  
+  // find the question name, as it is in the packet, and
+  // fold it to lowercase on the way, like the zone's names
+  const char* qname = buffer + sizeof(dns_header_t);
+  const char* end   = buffer + len;
+  char lower[DNS_WIRE_NAME_MAX];
+  uint32_t hash;
+  
+  int namelen = DNS_index::hashName(qname, end, hash, lower);
+  // then qtype and qclass
+  if (namelen == 0 || end - qname - namelen < (int) sizeof(dns_question_t))
+  {
+    hdr.rcode = FORMAT_ERROR;
+    hdr.q_count = 0;
+    return sizeof(dns_header_t);
+  }
+  const char* query = qname + namelen;
+  uint16_t qtype  = get16(query);
+  uint16_t qclass = get16(query + 2);
+  
+  // the response starts out as the header and the question, anything
+  // the client sent after the question (eg. EDNS) is dropped
+  int packetlen = query + sizeof(dns_question_t) - buffer;
+  if (packetlen > maxlen) return 0;
+  
+  if (qclass != DNS_CLASS_INET)
+  {
+    hdr.rcode = OP_REFUSED;
+    return packetlen;
+  }
+  
+  // the name itself, or what stands in for it
+  uint32_t data;
+  int records;
+  const DNS_index::entry_t* entry = find(lower, namelen, hash);
+  if (entry)
+  {
+    data    = entry->data;
+    records = entry->count;
+  }
+  else
+  {
+    DNS_index::match_t match;
+    const DNS_index::node_t* node = index.descend(lower, namelen, hash, match);
+    if (match == DNS_index::MATCH_CUT)
+      return addReferral(buffer, packetlen, maxlen, namelen, *node);
+    if (match != DNS_index::MATCH_WILDCARD)
+    {
+      hdr.rcode = NAME_ERROR;
+      if (index.encloses(lower, namelen))
+        return addSOA(buffer, packetlen, maxlen, namelen, false);
+      return packetlen;
+    }
+    data    = node->data;
+    records = node->records;
+  }
+  hdr.rcode = NO_ERROR;
+  
+  if (index.isApex(lower, namelen) &&
+      (qtype == DNS_TYPE_SOA || (qtype == DNS_TYPE_ANY && records == 0)))
+    return addSOA(buffer, packetlen, maxlen, namelen, true);
+  
+  // the name exists, but only has A records, if any
+  if ((qtype != DNS_TYPE_A && qtype != DNS_TYPE_ANY) || records == 0)
+  {
+    if (index.encloses(lower, namelen))
+      return addSOA(buffer, packetlen, maxlen, namelen, false);
+    return packetlen;
+  }
+  
+  // the answers were put together when the zone was built, all
+  // pointing at the question, which is just what a wildcard needs
+  int size;
+  const char* answers = index.answers(data, size);
+  
+  // never split an RRset, the client retries over TCP
+  if (packetlen + size > maxlen)
+  {
+    hdr.tc = DNS_TC_TRUNC;
+    return packetlen;
+  }
+  memcpy(buffer + packetlen, answers, size);
+  put16((char*) &hdr.ans_count, records);
+  return packetlen + size;
+}
+
+int DNS_zone::addSOA(char* buffer, int packetlen, int maxlen, int namelen, bool answer) const
+{
+  dns_header_t& hdr = *(dns_header_t*) buffer;
+  
+  // the record was put together when the zone was built
+  int size = index.soa(buffer + packetlen, maxlen - packetlen, namelen, answer);
+  if (size == 0)
+  {
+    // an answer can't be left out, but the authority can
+    if (answer) hdr.tc = DNS_TC_TRUNC;
+    return packetlen;
+  }
+  put16(answer ? (char*) &hdr.ans_count : (char*) &hdr.auth_count, 1);
+  return packetlen + size;
+}
+
+int DNS_zone::addReferral(char* buffer, int packetlen, int maxlen, int namelen,
+                          const DNS_index::node_t& cut) const
+{
+  dns_header_t& hdr = *(dns_header_t*) buffer;
+  // the answer is up to the nameservers we point at
+  hdr.aa    = 0;
+  hdr.rcode = NO_ERROR;
+  
+  int additional;
+  int size = index.referral(cut, buffer + packetlen, maxlen - packetlen, namelen, additional);
+  if (size == 0)
+  {
+    hdr.tc = DNS_TC_TRUNC;
+    return packetlen;
+  }
+  put16((char*) &hdr.auth_count, cut.records);
+  put16((char*) &hdr.add_count, additional);
+  return packetlen + size;
+}
@@ -0,0 +1,122 @@
+#ifndef DNS_ZONE_HPP
+#define DNS_ZONE_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "dns_index.hpp"
+
+// largest response over UDP without EDNS (RFC 1035)
+#define DNS_UDP_MAX   512
+// TTL for mappings that do not come with their own
+#define DNS_ZONE_TTL  3600
+
+/**
+ * The names a DNS server is authoritative for, and how to answer
+ * questions about them. Nothing in here knows about the network,
+ * so the same zone serves both IncludeOS and Linux.
+ * 
+ * Names are stored as www.google.com. (with the trailing dot),
+ * addresses as IPv4 in network byte order. Queries are answered from
+ * a flat index over the names, which build() has to (re)make after
+ * the last addMapping(), or which load() maps from a zone image.
+ * 
+ * Given an SOA record, the zone is authoritative for everything under
+ * its apex: names it doesn't have get NXDOMAIN, and types they don't
+ * have an empty answer, both with the SOA (RFC 2308). Names can also
+ * be wildcards (*.google.com, RFC 4592), answering for any name under
+ * their parent that isn't there, and names other than the apex with
+ * nameservers are zone cuts, where the zone refers everything at or
+ * under them to those nameservers.
+**/
+class DNS_zone
+{
+public:
+  typedef std::vector<uint32_t> addr_list;
+  
+  void addMapping(const std::string& key, const addr_list& values,
+                  uint32_t ttl = DNS_ZONE_TTL);
+  // add one more address for key, the lowest TTL given wins
+  void addAddress(const std::string& key, uint32_t addr,
+                  uint32_t ttl = DNS_ZONE_TTL);
+  // delegate key to the nameserver server (www.google.com.), which
+  // makes key a zone cut, unless it is the apex
+  void addNameserver(const std::string& key, const std::string& server,
+                     uint32_t ttl = DNS_ZONE_TTL);
+  // the zone's apex, and the SOA record that goes with it
+  void setSOA(const DNS_index::soa_t& soa);
+  bool hasSOA() const
+  {
+    return !soa.apex.empty();
+  }
+  
+  // make the index createResponse() answers from, out of the
+  // mappings (a zone fresh from load() is ready as it is)
+  void build()
+  {
+    if (!loaded) index.build(table, soa);
+  }
+  // write the built zone out as an image load() can map
+  bool save(const std::string& path) const
+  {
+    return index.save(path);
+  }
+  // answer from the zone image at path instead of any mappings,
+  // it is mapped as it is, so this takes no time whatever its size
+  bool load(const std::string& path)
+  {
+    loaded = index.map(path);
+    return loaded;
+  }
+  
+  // number of names we answer for
+  size_t size() const
+  {
+    return index.size();
+  }
+  // addresses added for name, or nullptr if we don't know it
+  const addr_list* lookup(const std::string& name) const;
+  // true if the query of len bytes in buffer asks about a name
+  // in the zone, or is something only the zone should answer
+  bool contains(const char* buffer, int len) const;
+  
+  // turn the query of len bytes in buffer into a response, in place,
+  // writing at most maxlen bytes, returns the length of the response,
+  // or 0 if the packet should be dropped
+  int createResponse(char* buffer, int len, int maxlen) const;
+  
+  // an IPv4 address in network byte order
+  static uint32_t ip4(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+  {
+    uint8_t part[4] = { a, b, c, d };
+    uint32_t whole;
+    memcpy(&whole, part, sizeof(whole));
+    return whole;
+  }
+  
+private:
+  // the lowercase name of namelen bytes in lower is in the index
+  const DNS_index::entry_t* find(const char* lower, int namelen, uint32_t hash) const
+  {
+    // most names that aren't there never get past the filter
+    return index.mayContain(hash) ? index.find(lower, namelen, hash) : nullptr;
+  }
+  // add the SOA record to the response of packetlen bytes in buffer,
+  // whose question is namelen bytes long, as an answer or not,
+  // returns the new length of the response
+  int addSOA(char* buffer, int packetlen, int maxlen, int namelen, bool answer) const;
+  // add the referral to the nameservers for cut, likewise
+  int addReferral(char* buffer, int packetlen, int maxlen, int namelen,
+                  const DNS_index::node_t& cut) const;
+  
+  std::map<std::string, DNS_index::mapping_t> table;
+  DNS_index::soa_t soa;
+  DNS_index index;
+  bool loaded = false;
+};
+
+#endif
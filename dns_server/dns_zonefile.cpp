@@ -0,0 +1,281 @@
+#include "dns_zonefile.hpp"
+
+#include <ctype.h>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <stdio.h>
+
+using namespace std;
+
+// TTL used until the file sets one with $TTL
+#define ZONEFILE_DEFAULT_TTL DNS_ZONE_TTL
+
+static string uppercase(string str)
+{
+  for (auto& c : str)
+    c = toupper((unsigned char) c);
+  return str;
+}
+
+// split a line into fields, dropping comments, and keeping
+// track of how deep into parentheses we are
+static void tokenize(const string& line, vector<string>& tokens, int& parens)
+{
+  size_t i = 0;
+  while (i < line.size())
+  {
+    char c = line[i];
+    
+    if (c == ';') break;
+    if (isspace((unsigned char) c)) { i++; continue; }
+    if (c == '(') { parens++; i++; continue; }
+    if (c == ')') { parens--; i++; continue; }
+    
+    string token;
+    if (c == '"')
+    {
+      // quoted strings keep their spaces and semicolons
+      for (i++; i < line.size() && line[i] != '"'; i++)
+      {
+        if (line[i] == '\\' && i + 1 < line.size()) i++;
+        token += line[i];
+      }
+      i++;
+    }
+    else
+    {
+      while (i < line.size() && !isspace((unsigned char) line[i])
+          && line[i] != ';' && line[i] != '(' && line[i] != ')')
+        token += line[i++];
+    }
+    tokens.push_back(token);
+  }
+}
+
+// 3600, or 1h, 2d3h and friends
+static bool parseTTL(const string& str, uint32_t& ttl)
+{
+  if (str.empty() || !isdigit((unsigned char) str[0])) return false;
+  
+  uint64_t total = 0, value = 0;
+  
+  for (char c : str)
+  {
+    if (isdigit((unsigned char) c))
+    {
+      value = value * 10 + (c - '0');
+      if (value > UINT32_MAX) return false;
+      continue;
+    }
+    switch (tolower((unsigned char) c))
+    {
+    case 's': total += value; break;
+    case 'm': total += value * 60; break;
+    case 'h': total += value * 3600; break;
+    case 'd': total += value * 86400; break;
+    case 'w': total += value * 604800; break;
+    default: return false;
+    }
+    value = 0;
+  }
+  total += value;
+  if (total > UINT32_MAX) return false;
+  
+  ttl = total;
+  return true;
+}
+
+static bool isClass(const string& str)
+{
+  string upper = uppercase(str);
+  return upper == "IN" || upper == "CH" || upper == "HS" || upper == "CS";
+}
+
+// make name absolute, relative to origin
+static string absolute(const string& name, const string& origin)
+{
+  if (name == "@") return origin;
+  if (!name.empty() && name.back() == '.') return name;
+  return name + "." + (origin == "." ? "" : origin);
+}
+
+bool DNS_zonefile::read(const string& path, const string& origin, DNS_zone& zone)
+{
+  ifstream file(path);
+  if (!file)
+  {
+    cerr << path << ": can't open zone file" << endl;
+    return false;
+  }
+  
+  string current = absolute(origin.empty() ? "." : origin, ".");
+  string owner = current;
+  uint32_t default_ttl = ZONEFILE_DEFAULT_TTL;
+  set<string> skipped;
+  
+  bool ok = true;
+  int  lineno = 0, first = 0;
+  string line;
+  vector<string> tokens;
+  int  parens = 0;
+  bool blank_owner = false;
+  
+  while (getline(file, line))
+  {
+    lineno++;
+    if (parens == 0)
+    {
+      // a record starting with whitespace belongs to the previous owner
+      tokens.clear();
+      first = lineno;
+      blank_owner = !line.empty() && isspace((unsigned char) line[0]);
+    }
+    tokenize(line, tokens, parens);
+    if (parens > 0) continue;
+    
+    if (parens < 0 || tokens.empty())
+    {
+      if (parens < 0)
+      {
+        cerr << path << ":" << first << ": unbalanced parentheses" << endl;
+        ok = false;
+      }
+      parens = 0;
+      continue;
+    }
+    
+    // directives
+    string directive = uppercase(tokens[0]);
+    if (directive == "$ORIGIN" && !blank_owner)
+    {
+      if (tokens.size() != 2)
+      {
+        cerr << path << ":" << first << ": $ORIGIN takes one name" << endl;
+        ok = false;
+        continue;
+      }
+      current = absolute(tokens[1], current);
+      continue;
+    }
+    if (directive == "$TTL" && !blank_owner)
+    {
+      if (tokens.size() != 2 || !parseTTL(tokens[1], default_ttl))
+      {
+        cerr << path << ":" << first << ": $TTL takes one TTL" << endl;
+        ok = false;
+      }
+      continue;
+    }
+    if (directive[0] == '$' && !blank_owner)
+    {
+      cerr << path << ":" << first << ": " << tokens[0] << " is not supported" << endl;
+      ok = false;
+      continue;
+    }
+    
+    // [owner] [ttl] [class] type rdata, with ttl and class either way around
+    record_t rec;
+    size_t t = 0;
+    if (!blank_owner) owner = absolute(tokens[t++], current);
+    rec.owner = owner;
+    rec.ttl   = default_ttl;
+    rec.origin = current;
+    
+    for (int i = 0; i < 2 && t < tokens.size(); i++)
+    {
+      if (parseTTL(tokens[t], rec.ttl)) t++;
+      else if (isClass(tokens[t]))
+      {
+        if (uppercase(tokens[t]) != "IN")
+        {
+          cerr << path << ":" << first << ": only class IN is supported" << endl;
+          ok = false;
+        }
+        t++;
+      }
+    }
+    if (t >= tokens.size())
+    {
+      cerr << path << ":" << first << ": record has no type" << endl;
+      ok = false;
+      continue;
+    }
+    rec.type  = uppercase(tokens[t++]);
+    rec.rdata.assign(tokens.begin() + t, tokens.end());
+    
+    string error;
+    if (!add(rec, zone, error))
+    {
+      if (error.empty())
+      {
+        if (skipped.insert(rec.type).second)
+          cerr << path << ":" << first << ": warning: skipping "
+               << rec.type << " records" << endl;
+        continue;
+      }
+      cerr << path << ":" << first << ": " << error << endl;
+      ok = false;
+    }
+  }
+  if (parens > 0)
+  {
+    cerr << path << ":" << first << ": unbalanced parentheses" << endl;
+    ok = false;
+  }
+  return ok;
+}
+
+bool DNS_zonefile::add(const record_t& rec, DNS_zone& zone, string& error)
+{
+  if (rec.type == "A")
+  {
+    unsigned a, b, c, d;
+    char end;
+    if (rec.rdata.size() != 1 ||
+        sscanf(rec.rdata[0].c_str(), "%u.%u.%u.%u%c", &a, &b, &c, &d, &end) != 4 ||
+        a > 255 || b > 255 || c > 255 || d > 255)
+    {
+      error = "A record needs one IPv4 address";
+      return false;
+    }
+    zone.addAddress(rec.owner, DNS_zone::ip4(a, b, c, d), rec.ttl);
+    return true;
+  }
+  if (rec.type == "NS")
+  {
+    if (rec.rdata.size() != 1)
+    {
+      error = "NS record needs one name";
+      return false;
+    }
+    zone.addNameserver(rec.owner, absolute(rec.rdata[0], rec.origin), rec.ttl);
+    return true;
+  }
+  if (rec.type == "SOA")
+  {
+    // mname rname serial refresh retry expire minimum
+    DNS_index::soa_t soa;
+    if (rec.rdata.size() != 7 ||
+        !parseTTL(rec.rdata[2], soa.serial)  || !parseTTL(rec.rdata[3], soa.refresh) ||
+        !parseTTL(rec.rdata[4], soa.retry)   || !parseTTL(rec.rdata[5], soa.expire)  ||
+        !parseTTL(rec.rdata[6], soa.minimum))
+    {
+      error = "SOA record needs two names and five numbers";
+      return false;
+    }
+    if (zone.hasSOA())
+    {
+      error = "a zone has only the one SOA record";
+      return false;
+    }
+    soa.apex  = rec.owner;
+    soa.mname = absolute(rec.rdata[0], rec.origin);
+    soa.rname = absolute(rec.rdata[1], rec.origin);
+    soa.ttl   = rec.ttl;
+    zone.setSOA(soa);
+    return true;
+  }
+  // a type we can't serve (yet)
+  return false;
+}
@@ -0,0 +1,39 @@
+#ifndef DNS_ZONEFILE_HPP
+#define DNS_ZONEFILE_HPP
+
+#include "dns_zone.hpp"
+
+#include <string>
+#include <vector>
+
+/**
+ * Reads zones in master file format (RFC 1035 section 5)
+ * 
+ * $ORIGIN and $TTL are understood, as are @, relative names, blank
+ * owners, comments and records spread over lines in parentheses.
+ * Record types the zone can't serve are skipped with a warning.
+ * Errors are reported as path:line: message on stderr.
+**/
+class DNS_zonefile
+{
+public:
+  // add the records in the file at path to zone, with names relative
+  // to origin (www.google.com.) until the file says otherwise,
+  // returns false if the file couldn't be read or had errors
+  static bool read(const std::string& path, const std::string& origin, DNS_zone& zone);
+  
+private:
+  struct record_t
+  {
+    std::string owner; // absolute, with the trailing dot
+    uint32_t    ttl;
+    std::string type;  // uppercase
+    std::vector<std::string> rdata;
+    std::string origin; // for relative names in rdata
+  };
+  
+  // put a parsed record into zone, returns false if it is malformed
+  static bool add(const record_t& rec, DNS_zone& zone, std::string& error);
+};
+
+#endif
@@ -0,0 +1,327 @@
+#include "linux_server.hpp"
+#include "../src/dns_metrics.hpp"
+
+#include <chrono>
+#include <errno.h>
+#include <iostream>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace std;
+
+static uint64_t now_ns()
+{
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(
+      steady_clock::now().time_since_epoch()).count();
+}
+static uint64_t wall_ns()
+{
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(
+      system_clock::now().time_since_epoch()).count();
+}
+
+LinuxDNS_server::LinuxDNS_server()
+  : zone(new DNS_zone), metricsPort(0), running(false) {}
+
+LinuxDNS_server::~LinuxDNS_server()
+{
+  stop();
+  for (auto& worker : workers)
+  {
+    if (worker->thread.joinable()) worker->thread.join();
+    close(worker->sock);
+  }
+}
+
+int LinuxDNS_server::openSocket(uint16_t port)
+{
+  int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  if (sock < 0)
+  {
+    cout << "<DNS SERVER> socket: " << strerror(errno) << endl;
+    return -1;
+  }
+  
+  // every worker binds the same port, the kernel spreads the load
+  int on = 1;
+  setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+  
+  // wake up now and then to see if we should stop
+  timeval tv;
+  tv.tv_sec  = 0;
+  tv.tv_usec = DNS_SERVER_POLL_MS * 1000;
+  setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  
+  // tell us when each packet came in, to know what to shed
+  setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+  
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port   = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  
+  if (bind(sock, (sockaddr*) &addr, sizeof(addr)) < 0)
+  {
+    cout << "<DNS SERVER> bind: " << strerror(errno) << endl;
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+bool LinuxDNS_server::start(uint16_t port, int count)
+{
+  // the cores we are allowed to run on
+  cpu_set_t allowed;
+  vector<int> cpus;
+  
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+  {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+      if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+  }
+  if (count <= 0)
+    count = cpus.empty() ? 1 : cpus.size();
+  
+  cout << "Starting DNS server on port " << port
+       << " with " << count << " worker(s).." << endl;
+  
+  zone->build();
+  zones.reset(new DNS_snapshot(count, std::move(zone)));
+  
+  for (int i = 0; i < count; i++)
+  {
+    unique_ptr<worker_t> worker(new worker_t);
+    
+    worker->id   = i;
+    worker->log  = querylog ? querylog->ring() : nullptr;
+    worker->limited = 0;
+    worker->sock = openSocket(port);
+    if (worker->sock < 0) return false;
+    
+    // only pin when there is a core for everyone
+    worker->cpu = ((int) cpus.size() >= count) ? cpus[i] : -1;
+    workers.push_back(move(worker));
+  }
+  if (forwarder && ratelimit)
+    forwarder->set_ratelimit(ratelimit.get());
+  if (querylog)
+  {
+    if (forwarder) forwarder->set_log(querylog->ring());
+    if (!querylog->start()) return false;
+  }
+  if (metricsPort)
+  {
+    if (!exporter.start(metricsPort)) return false;
+    cout << "Serving metrics on port " << metricsPort << endl;
+  }
+  return true;
+}
+
+void LinuxDNS_server::run()
+{
+  running = true;
+  if (forwarder) forwarder->start();
+  
+  for (auto& worker : workers)
+  {
+    worker_t* w = worker.get();
+    w->thread = thread([this, w] { serve(*w); });
+  }
+  for (auto& worker : workers)
+    worker->thread.join();
+  
+  if (forwarder) forwarder->stop();
+  if (querylog) querylog->stop();
+  exporter.stop();
+}
+
+void LinuxDNS_server::serve(worker_t& worker)
+{
+  if (worker.cpu >= 0)
+  {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(worker.cpu, &cpuset);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+  }
+  
+  // first touched from the core that will use them
+  worker.buffers.reset(new char[DNS_SERVER_BATCH * DNS_SERVER_BUFSIZE]);
+  
+  // every message receives into its own buffer, for good
+  for (int i = 0; i < DNS_SERVER_BATCH; i++)
+  {
+    worker.iovs[i].iov_base = worker.buffers.get() + i * DNS_SERVER_BUFSIZE;
+    
+    memset(&worker.msgs[i], 0, sizeof(mmsghdr));
+    worker.msgs[i].msg_hdr.msg_name = &worker.addrs[i];
+    worker.msgs[i].msg_hdr.msg_iov  = &worker.iovs[i];
+    worker.msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  
+  while (running)
+  {
+    // the kernel shrinks these, so put them back before every read
+    for (int i = 0; i < DNS_SERVER_BATCH; i++)
+    {
+      worker.iovs[i].iov_len = DNS_SERVER_BUFSIZE;
+      worker.msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+      worker.msgs[i].msg_hdr.msg_control = worker.control[i];
+      worker.msgs[i].msg_hdr.msg_controllen = sizeof(worker.control[i]);
+    }
+    
+    // block for the first packet, then take whatever else is queued
+    int count = recvmmsg(worker.sock, worker.msgs, DNS_SERVER_BATCH, MSG_WAITFORONE, nullptr);
+    if (count < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) continue;
+      cout << "<DNS SERVER> recvmmsg: " << strerror(errno) << endl;
+      break;
+    }
+    worker.received = now_ns();
+    worker.arrived  = wall_ns();
+    
+    // hold on to the zone only for as long as it takes to answer
+    const DNS_zone* current = zones->enter(worker.id);
+    int replycount = answer(worker, *current, count);
+    zones->leave(worker.id);
+    
+    send(worker, replycount);
+    
+    // every response in the batch waited for all of it
+    uint64_t latency = now_ns() - worker.received;
+    DnsMetrics::count(DNS_SERVER_QUERIES, count);
+    if (replycount)
+      DnsMetrics::record(DNS_SERVER_TIME, latency, replycount);
+    if (worker.log)
+      logReplies(worker, replycount, worker.arrived, latency);
+  }
+}
+
+void LinuxDNS_server::reload(std::unique_ptr<DNS_zone> zone)
+{
+  zone->build();
+  zones->publish(std::move(zone));
+}
+
+int LinuxDNS_server::answer(worker_t& worker, const DNS_zone& zone, int count)
+{
+  int replycount = 0;
+  
+  for (int i = 0; i < count; i++)
+  {
+    char* buffer = (char*) worker.iovs[i].iov_base;
+    int len = worker.msgs[i].msg_len;
+    int packetlen = -1;
+    
+    // don't spend anything on whoever stopped waiting
+    if (stale(worker, i))
+    {
+      DnsMetrics::count(DNS_SERVER_SHED);
+      continue;
+    }
+    
+    // names outside the zone are answered from the cache, or
+    // from upstream later on, unless they are no names at all
+    if (forwarder && !zone.contains(buffer, len))
+      packetlen = forwarder->forward(worker.sock, worker.addrs[i],
+                                     buffer, len, DNS_SERVER_BUFSIZE);
+    if (packetlen < 0)
+      packetlen = zone.createResponse(buffer, len, DNS_UDP_MAX);
+    if (packetlen == 0) continue;
+    
+    if (ratelimit)
+    {
+      dns_rrl_verdict_t verdict = ratelimit->check(
+          worker.addrs[i].sin_addr.s_addr, buffer, packetlen,
+          worker.received / 1000000, worker.limited);
+      if (verdict == DNS_RRL_DROP)
+      {
+        DnsMetrics::count(DNS_SERVER_RATE_LIMITED);
+        continue;
+      }
+      if (verdict == DNS_RRL_TRUNCATE)
+      {
+        packetlen = DNS_ratelimit::truncate(buffer, packetlen);
+        DnsMetrics::count(DNS_SERVER_SLIPPED);
+      }
+    }
+    DnsMetrics::response(buffer);
+    
+    // send the response from where the query came in,
+    // back to where it came from, with nothing but the data
+    worker.iovs[i].iov_len = packetlen;
+    worker.replies[replycount] = worker.msgs[i];
+    worker.replies[replycount].msg_hdr.msg_control = nullptr;
+    worker.replies[replycount].msg_hdr.msg_controllen = 0;
+    replycount++;
+  }
+  return replycount;
+}
+
+bool LinuxDNS_server::stale(const worker_t& worker, int i) const
+{
+  msghdr& msg = const_cast<msghdr&>(worker.msgs[i].msg_hdr);
+  for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+  {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_TIMESTAMPNS)
+      continue;
+    
+    timespec ts;
+    memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+    uint64_t stamp = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    // the clock may have been set back in the meantime
+    return worker.arrived > stamp &&
+           worker.arrived - stamp > DNS_SERVER_SHED_MS * 1000000ull;
+  }
+  return false;
+}
+
+void LinuxDNS_server::logReplies(worker_t& worker, int replycount,
+                                 uint64_t arrived, uint64_t latency)
+{
+  for (int i = 0; i < replycount; i++)
+  {
+    dns_log_record_t* rec = worker.log->reserve();
+    if (rec == nullptr)
+    {
+      // the ring is full, so is the rest of the batch
+      DnsMetrics::count(DNS_SERVER_LOG_DROPPED, replycount - i);
+      return;
+    }
+    const msghdr& msg = worker.replies[i].msg_hdr;
+    const sockaddr_in& addr = *(const sockaddr_in*) msg.msg_name;
+    
+    dns_log_response(*rec, (const char*) msg.msg_iov->iov_base, msg.msg_iov->iov_len);
+    rec->time_ns    = arrived;
+    rec->latency_ns = min<uint64_t>(latency, UINT32_MAX);
+    rec->client     = addr.sin_addr.s_addr;
+    rec->port       = addr.sin_port;
+    worker.log->commit();
+  }
+}
+
+void LinuxDNS_server::send(worker_t& worker, int replycount)
+{
+  int sent = 0;
+  while (sent < replycount)
+  {
+    int res = sendmmsg(worker.sock, worker.replies + sent, replycount - sent, 0);
+    if (res < 0)
+    {
+      if (errno == EINTR) continue;
+      // the reply at the head of the batch is lost, like any UDP packet
+      cout << "<DNS SERVER> sendmmsg: " << strerror(errno) << endl;
+      sent++;
+      continue;
+    }
+    sent += res;
+  }
+}
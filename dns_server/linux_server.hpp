@@ -0,0 +1,156 @@
+#ifndef LINUX_SERVER_HPP
+#define LINUX_SERVER_HPP
+
+#include "dns_zone.hpp"
+#include "dns_snapshot.hpp"
+#include "dns_forwarder.hpp"
+#include "dns_exporter.hpp"
+#include "dns_querylog.hpp"
+#include "dns_ratelimit.hpp"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <time.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+// packets read and answered per system call
+#define DNS_SERVER_BATCH   64
+// room for any query we care to answer
+#define DNS_SERVER_BUFSIZE 4096
+// how often blocked workers check if they should stop
+#define DNS_SERVER_POLL_MS 250
+// queries that waited longer than this to be read are dropped, the
+// client has given up on them or is about to ask again
+#define DNS_SERVER_SHED_MS 500
+
+/**
+ * Linux front end for a DNS_zone
+ * 
+ * Every worker thread has its own SO_REUSEPORT socket, so the kernel
+ * spreads incoming queries across them, and is pinned to a core of
+ * its own. Workers read queries in batches with recvmmsg(), turn each
+ * one into its response in the buffer it arrived in (the same way the
+ * IncludeOS listener rewrites the incoming packet), and send the whole
+ * batch back with sendmmsg().
+ * 
+ * The zone is an immutable snapshot shared by all workers, and a new
+ * one can be swapped in with reload() at any time without stopping or
+ * blocking them. Everything else belongs to a single worker.
+ * 
+ * Given upstream nameservers, the server also forwards the queries
+ * for names outside the zone to them, and caches their answers.
+ * 
+ * Workers count what they answer and time how long it takes, see
+ * DnsMetrics, which can be scraped over HTTP with exportMetrics(), and
+ * can log every query they answer, see logQueries().
+ * 
+ * Under load, the server keeps up by not answering: queries that sat
+ * in the socket for longer than DNS_SERVER_SHED_MS are dropped unread,
+ * going by the time the kernel received them, and with limitRate() so
+ * are responses over a rate per client, see DNS_ratelimit.
+**/
+class LinuxDNS_server
+{
+public:
+  LinuxDNS_server();
+  ~LinuxDNS_server();
+  
+  // the zone to fill in before start()
+  void addMapping(const std::string& key, const DNS_zone::addr_list& values)
+  {
+    zone->addMapping(key, values);
+  }
+  DNS_zone& getZone()
+  {
+    return *zone;
+  }
+  // forward what the zone can't answer to the nameserver at address,
+  // along with any others given, before start()
+  void forwardTo(const std::string& address, uint16_t port = 53)
+  {
+    if (!forwarder) forwarder.reset(new DNS_forwarder);
+    forwarder->add_upstream(address, port);
+  }
+  // log every query answered to a binary log at path, before start()
+  void logQueries(const std::string& path)
+  {
+    querylog.reset(new DNS_querylog(path));
+  }
+  // limit responses to rate a second per client and kind, sending
+  // every slip-th over it truncated, before start()
+  void limitRate(int rate, int slip = DNS_RRL_SLIP)
+  {
+    ratelimit.reset(new DNS_ratelimit(rate, slip));
+  }
+  // serve the metrics to Prometheus over HTTP on port, before start()
+  void exportMetrics(uint16_t port)
+  {
+    metricsPort = port;
+  }
+  
+  // bind workers to port on all interfaces, one per core when
+  // workers is 0, returns false if any of them failed
+  bool start(uint16_t port, int workers = 1);
+  // answer queries until stop() is called
+  void run();
+  void stop()
+  {
+    running = false;
+  }
+  
+  // build zone and start answering from it instead, can be called
+  // from any thread once the server has started, and returns when
+  // the old zone is gone
+  void reload(std::unique_ptr<DNS_zone> zone);
+  
+private:
+  // everything one worker touches while answering, allocated
+  // by the worker itself so it lives close to its core
+  struct worker_t
+  {
+    int id;
+    int sock;
+    int cpu; // -1 to run anywhere
+    std::thread thread;
+    DNS_logring* log; // nullptr when not logging
+    uint32_t limited; // responses rate limited, for slip
+    uint64_t received; // when the batch was read, steady clock
+    uint64_t arrived;  // and wall clock
+    
+    std::unique_ptr<char[]> buffers;
+    mmsghdr     msgs[DNS_SERVER_BATCH];
+    mmsghdr     replies[DNS_SERVER_BATCH];
+    iovec       iovs[DNS_SERVER_BATCH];
+    sockaddr_in addrs[DNS_SERVER_BATCH];
+    // when the kernel received each packet
+    char control[DNS_SERVER_BATCH][CMSG_SPACE(sizeof(timespec))];
+  };
+  
+  int  openSocket(uint16_t port);
+  void serve(worker_t& worker);
+  // turn a batch of count received packets into replies, returns
+  // how many of them there are, then send them
+  int  answer(worker_t& worker, const DNS_zone& zone, int count);
+  // true if the packet i of the batch waited too long to be answered
+  bool stale(const worker_t& worker, int i) const;
+  void send(worker_t& worker, int replycount);
+  // log the replies sent, for queries that arrived at wall clock
+  // time arrived and took latency nanoseconds to answer
+  void logReplies(worker_t& worker, int replycount, uint64_t arrived, uint64_t latency);
+  
+  std::unique_ptr<DNS_zone> zone; // until start()
+  std::unique_ptr<DNS_snapshot> zones;
+  std::vector<std::unique_ptr<worker_t>> workers;
+  std::unique_ptr<DNS_forwarder> forwarder; // if forwarding
+  std::unique_ptr<DNS_querylog> querylog; // if logging
+  std::unique_ptr<DNS_ratelimit> ratelimit; // if limiting
+  DNS_exporter exporter;
+  uint16_t metricsPort; // 0 for none
+  std::atomic<bool> running;
+};
+
+#endif
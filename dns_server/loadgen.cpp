@@ -0,0 +1,325 @@
+#include "../src/dns.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// a query not answered within this is counted as lost
+#define LOAD_TIMEOUT_MS  1000
+// how often to look for lost queries
+#define LOAD_SCAN_MS       10
+// replies taken off the socket at a time
+#define LOAD_BATCH         64
+
+using namespace std;
+
+static uint64_t now_ns()
+{
+  using namespace std::chrono;
+  return duration_cast<nanoseconds>(
+      steady_clock::now().time_since_epoch()).count();
+}
+
+// what one thread saw
+struct load_stats_t
+{
+  uint64_t sent = 0;
+  uint64_t answered = 0;
+  uint64_t lost = 0;
+  uint64_t rcodes[16] = { 0 };
+  vector<uint32_t> latency; // nanoseconds, one per answer
+};
+
+/**
+ * Keeps a number of queries outstanding against the server, on one
+ * socket of its own, sending the next one as soon as one is answered
+ * (or lost), until the time is up
+**/
+class LoadThread
+{
+public:
+  LoadThread(const vector<string>& queries, const sockaddr_in& server,
+             int outstanding, int first)
+    : queries(queries), server(server), window(outstanding), next(first) {}
+  
+  bool run(uint64_t until, load_stats_t& stats);
+
+private:
+  struct slot_t
+  {
+    uint64_t sent;  // when, 0 for a free slot
+    uint16_t id;
+  };
+  
+  bool send(slot_t& slot, load_stats_t& stats);
+  
+  const vector<string>& queries;
+  sockaddr_in server;
+  int  window;
+  int  next;   // the query to send next
+  int  sock;
+  uint16_t ids = 0;
+  vector<slot_t> slots;
+  // the slot waiting for each ID, -1 for none
+  vector<int> waiting;
+};
+
+bool LoadThread::send(slot_t& slot, load_stats_t& stats)
+{
+  // the next ID nobody is waiting for
+  while (waiting[++ids] >= 0);
+  
+  const string& query = queries[next];
+  next = (next + 1) % queries.size();
+  
+  char packet[DNS_REQUEST_MAX];
+  memcpy(packet, query.data(), query.size());
+  ((dns_header_t*) packet)->id = ids;
+  
+  if (::send(sock, packet, query.size(), 0) < 0)
+  {
+    // a full send buffer only slows us down
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) return true;
+    cerr << "send: " << strerror(errno) << endl;
+    return false;
+  }
+  slot.sent = now_ns();
+  slot.id   = ids;
+  waiting[ids] = &slot - slots.data();
+  stats.sent++;
+  return true;
+}
+
+bool LoadThread::run(uint64_t until, load_stats_t& stats)
+{
+  sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP);
+  if (sock < 0 || connect(sock, (sockaddr*) &server, sizeof(server)) < 0)
+  {
+    cerr << "socket: " << strerror(errno) << endl;
+    if (sock >= 0) close(sock);
+    return false;
+  }
+  slots.assign(window, slot_t());
+  waiting.assign(65536, -1);
+  
+  uint64_t timeout = LOAD_TIMEOUT_MS * 1000000ull;
+  uint64_t scanned = now_ns();
+  int outstanding = 0;
+  bool ok = true;
+  
+  while (ok)
+  {
+    uint64_t now = now_ns();
+    bool sending = now < until;
+    
+    // keep the window full until the time is up, then wait for the rest
+    for (auto& slot : slots)
+    {
+      if (!sending || !ok) break;
+      if (slot.sent) continue;
+      ok = send(slot, stats);
+      if (slot.sent) outstanding++;
+    }
+    if (!sending && outstanding == 0) break;
+    
+    pollfd pfd = { sock, POLLIN, 0 };
+    poll(&pfd, 1, 1);
+    now = now_ns();
+    
+    char reply[DNS_REQUEST_MAX * 2];
+    for (int i = 0; i < LOAD_BATCH; i++)
+    {
+      int len = recv(sock, reply, sizeof(reply), 0);
+      if (len < (int) sizeof(dns_header_t)) break;
+      
+      const dns_header_t& hdr = *(const dns_header_t*) reply;
+      int idx = waiting[hdr.id];
+      // too late, or not ours
+      if (idx < 0) continue;
+      
+      slot_t& slot = slots[idx];
+      stats.latency.push_back(now - slot.sent);
+      stats.answered++;
+      stats.rcodes[hdr.rcode]++;
+      
+      waiting[hdr.id] = -1;
+      slot.sent = 0;
+      outstanding--;
+    }
+    
+    // queries that have waited too long are given up on
+    if (now - scanned >= LOAD_SCAN_MS * 1000000ull)
+    {
+      scanned = now;
+      for (auto& slot : slots)
+      {
+        if (slot.sent == 0 || now - slot.sent < timeout) continue;
+        waiting[slot.id] = -1;
+        slot.sent = 0;
+        outstanding--;
+        stats.lost++;
+      }
+    }
+  }
+  close(sock);
+  return ok;
+}
+
+// one query per line, a name and then its type (A if there is none),
+// the format of dnsperf's query files
+static bool readQueries(const string& path, vector<string>& queries)
+{
+  ifstream file(path);
+  if (!file) return false;
+  
+  static const pair<const char*, uint16_t> types[] =
+  {
+    { "A", DNS_TYPE_A }, { "NS", DNS_TYPE_NS }, { "CNAME", DNS_TYPE_CNAME },
+    { "SOA", DNS_TYPE_SOA }, { "PTR", DNS_TYPE_PTR }, { "MX", DNS_TYPE_MX },
+    { "TXT", DNS_TYPE_TXT }, { "AAAA", DNS_TYPE_AAAA }, { "SRV", DNS_TYPE_SRV },
+    { "ANY", DNS_TYPE_ANY },
+  };
+  
+  string line;
+  int lineno = 0;
+  while (getline(file, line))
+  {
+    lineno++;
+    istringstream fields(line);
+    string name, type = "A";
+    if (!(fields >> name) || name[0] == ';' || name[0] == '#') continue;
+    fields >> type;
+    transform(type.begin(), type.end(), type.begin(), ::toupper);
+    
+    uint16_t qtype = 0;
+    for (auto& t : types)
+      if (type == t.first) qtype = t.second;
+    if (qtype == 0 && type.compare(0, 4, "TYPE") == 0)
+      qtype = atoi(type.c_str() + 4);
+    
+    char query[DNS_REQUEST_MAX];
+    DnsRequestBuilder builder(query, sizeof(query), 0);
+    if (qtype == 0 || !builder.addQuestion(name.c_str(), qtype))
+    {
+      cerr << path << ":" << lineno << ": skipping " << line << endl;
+      continue;
+    }
+    queries.push_back(string(query, builder.length()));
+  }
+  return !queries.empty();
+}
+
+static double percentile(const vector<uint32_t>& sorted, double p)
+{
+  if (sorted.empty()) return 0;
+  size_t idx = min(sorted.size() - 1, (size_t) (p * sorted.size()));
+  return sorted[idx] / 1000.0;
+}
+
+// dns_load <server> [port] [query file, - for www.google.com] [seconds]
+//          [queries outstanding] [threads]
+// replays the queries against the server, over and over, and
+// reports the rate it answers at and how long the answers took
+int main(int argc, char** argv)
+{
+  if (argc < 2)
+  {
+    cout << "Usage: " << argv[0] << " <server> [port] [query file, - for www.google.com]"
+         << " [seconds] [queries outstanding] [threads]" << endl;
+    return 1;
+  }
+  sockaddr_in server;
+  memset(&server, 0, sizeof(server));
+  server.sin_family = AF_INET;
+  server.sin_port   = htons((argc > 2) ? atoi(argv[2]) : DNS_PORT);
+  if (inet_pton(AF_INET, argv[1], &server.sin_addr) != 1)
+  {
+    cerr << argv[1] << ": not an IPv4 address" << endl;
+    return 1;
+  }
+  string path     = (argc > 3) ? argv[3] : "-";
+  int seconds     = (argc > 4) ? atoi(argv[4]) : 10;
+  int outstanding = (argc > 5) ? atoi(argv[5]) : 64;
+  int threads     = (argc > 6) ? atoi(argv[6]) : 1;
+  if (seconds <= 0 || outstanding <= 0 || threads <= 0 || outstanding > 32768)
+  {
+    cerr << "Seconds, queries outstanding (up to 32768) and threads must be positive" << endl;
+    return 1;
+  }
+  
+  vector<string> queries;
+  if (path == "-")
+  {
+    char query[DNS_REQUEST_MAX];
+    DnsRequestBuilder builder(query, sizeof(query), 0);
+    builder.addQuestion("www.google.com", DNS_TYPE_A);
+    queries.push_back(string(query, builder.length()));
+  }
+  else if (!readQueries(path, queries))
+  {
+    cerr << path << ": no queries to send" << endl;
+    return 1;
+  }
+  
+  cout << "Sending " << queries.size() << " queries to " << argv[1] << ":"
+       << ntohs(server.sin_port) << " for " << seconds << "s, "
+       << outstanding << " outstanding on each of " << threads << " thread(s)" << endl;
+  
+  vector<load_stats_t> stats(threads);
+  vector<thread> running;
+  atomic<bool> failed(false);
+  uint64_t start = now_ns();
+  uint64_t until = start + seconds * 1000000000ull;
+  
+  for (int t = 0; t < threads; t++)
+  {
+    running.emplace_back([&, t]
+    {
+      // each thread starts somewhere else in the queries
+      LoadThread load(queries, server, outstanding, t * queries.size() / threads);
+      if (!load.run(until, stats[t])) failed = true;
+    });
+  }
+  for (auto& t : running) t.join();
+  double elapsed = (now_ns() - start) / 1e9;
+  if (failed) return 1;
+  
+  load_stats_t total;
+  for (auto& s : stats)
+  {
+    total.sent     += s.sent;
+    total.answered += s.answered;
+    total.lost     += s.lost;
+    for (int r = 0; r < 16; r++) total.rcodes[r] += s.rcodes[r];
+    total.latency.insert(total.latency.end(), s.latency.begin(), s.latency.end());
+  }
+  sort(total.latency.begin(), total.latency.end());
+  
+  cout << fixed << setprecision(1);
+  cout << "Queries sent:     " << total.sent << endl;
+  cout << "Answered:         " << total.answered << " (" << total.rcodes[NO_ERROR]
+       << " NOERROR, " << total.rcodes[NAME_ERROR] << " NXDOMAIN, "
+       << total.answered - total.rcodes[NO_ERROR] - total.rcodes[NAME_ERROR] << " other)" << endl;
+  cout << "Lost:             " << total.lost << endl;
+  cout << "Queries/second:   " << total.answered / elapsed << endl;
+  cout << "Latency (us):     p50 " << percentile(total.latency, 0.50)
+       << "  p99 "  << percentile(total.latency, 0.99)
+       << "  p999 " << percentile(total.latency, 0.999)
+       << "  max "  << (total.latency.empty() ? 0 : total.latency.back() / 1000.0) << endl;
+  return 0;
+}
@@ -0,0 +1,48 @@
+#include "dns_querylog.hpp"
+
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+static bool catLog(const char* path)
+{
+  ifstream file(path, ios::binary);
+  uint32_t magic = 0;
+  if (!file.read((char*) &magic, sizeof(magic)) || magic != DNS_LOG_MAGIC)
+  {
+    cerr << path << ": not a query log, or not from a machine like this one" << endl;
+    return false;
+  }
+  
+  const size_t header = offsetof(dns_log_record_t, name);
+  dns_log_record_t rec;
+  char line[512];
+  
+  while (file.read((char*) &rec, header))
+  {
+    if (!file.read(rec.name, rec.namelen))
+    {
+      cerr << path << ": ends in the middle of a record" << endl;
+      return false;
+    }
+    if (dns_log_format(rec, line, sizeof(line)) > 0)
+      cout << line << '\n';
+  }
+  return true;
+}
+
+// dns_logcat <query log...>
+// prints the queries in the logs a server wrote, one per line
+int main(int argc, char** argv)
+{
+  if (argc < 2)
+  {
+    cout << "Usage: " << argv[0] << " <query log...>" << endl;
+    return 1;
+  }
+  bool ok = true;
+  for (int i = 1; i < argc; i++)
+    ok = catLog(argv[i]) && ok;
+  return ok ? 0 : 1;
+}
@@ -1,3 +1,113 @@
+#include "dns_zone.hpp"
+
+// the zone we serve, on every platform
+static void fillZone(DNS_zone& zone)
+{
+  /// www.google.com ///
+  DNS_zone::addr_list mapping1;
+  mapping1.push_back( DNS_zone::ip4(213, 155, 151, 187) );
+  mapping1.push_back( DNS_zone::ip4(213, 155, 151, 185) );
+  mapping1.push_back( DNS_zone::ip4(213, 155, 151, 180) );
+  mapping1.push_back( DNS_zone::ip4(213, 155, 151, 183) );
+  mapping1.push_back( DNS_zone::ip4(213, 155, 151, 186) );
+  mapping1.push_back( DNS_zone::ip4(213, 155, 151, 184) );
+  mapping1.push_back( DNS_zone::ip4(213, 155, 151, 181) );
+  mapping1.push_back( DNS_zone::ip4(213, 155, 151, 182) );
+  
+  zone.addMapping("www.google.com.", mapping1);
+  ///               ///
+}
+
+#ifdef __linux__
+#include "linux_server.hpp"
+#include <iostream>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+
+// the zone image to serve, if not the built-in zone
+static std::string image;
+
+static bool loadZone(DNS_zone& zone)
+{
+  if (image.empty())
+  {
+    fillZone(zone);
+    return true;
+  }
+  if (zone.load(image)) return true;
+  
+  std::cout << "<DNS SERVER> " << image << " is not a zone image" << std::endl;
+  return false;
+}
+
+// dns_server [port] [workers, 0 for one per core] [zone image, - for the built-in one]
+//            [upstream nameservers to forward everything else to...]
+// with DNS_METRICS_PORT set, serves its metrics on that port at /metrics,
+// with DNS_QUERY_LOG set, logs every query answered to that file,
+// with DNS_RRL_RATE set, limits responses to that many a second per
+// client and kind, one in DNS_RRL_SLIP of those over it sent truncated
+int main(int argc, char** argv)
+{
+  uint16_t port = (argc > 1) ? atoi(argv[1]) : 53;
+  int   workers = (argc > 2) ? atoi(argv[2]) : 1;
+  if (argc > 3 && std::string(argv[3]) != "-") image = argv[3];
+  
+  LinuxDNS_server server;
+  if (!loadZone(server.getZone()))
+    return 1;
+  
+  for (int i = 4; i < argc; i++)
+    server.forwardTo(argv[i]);
+  
+  const char* metrics = getenv("DNS_METRICS_PORT");
+  if (metrics && atoi(metrics) > 0)
+    server.exportMetrics(atoi(metrics));
+  const char* querylog = getenv("DNS_QUERY_LOG");
+  if (querylog && *querylog)
+    server.logQueries(querylog);
+  const char* rate = getenv("DNS_RRL_RATE");
+  const char* slip = getenv("DNS_RRL_SLIP");
+  if (rate && atoi(rate) > 0)
+    server.limitRate(atoi(rate), slip ? atoi(slip) : DNS_RRL_SLIP);
+  
+  // signals go to the control thread below, never to a worker
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGHUP);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  
+  if (!server.start(port, workers))
+    return 1;
+  std::cout << "<DNS SERVER> Listening on UDP port " << port << std::endl;
+  
+  // SIGHUP reloads the zone, SIGINT and SIGTERM stop the server
+  std::thread control(
+  [&server, &signals]
+  {
+    int sig;
+    while (sigwait(&signals, &sig) == 0 && sig == SIGHUP)
+    {
+      std::unique_ptr<DNS_zone> zone(new DNS_zone);
+      if (!loadZone(*zone)) continue;
+      
+      server.reload(std::move(zone));
+      std::cout << "<DNS SERVER> Zone reloaded" << std::endl;
+    }
+    server.stop();
+  });
+  
+  server.run();
+  
+  // the workers may have stopped on their own
+  pthread_kill(control.native_handle(), SIGTERM);
+  control.join();
+  return 0;
+}
+
+#else
 #include <os>
 #include <class_dev.hpp>
 #include <assert.h>
@@ -26,22 +136,12 @@ void Service::start()
 	std::cout << "...Starting UDP server on IP " 
 			<< inet->ip4(net::ETH0).str() << std::endl;
 	
-  /// www.google.com ///
-  std::vector<IP4::addr> mapping1;
-  mapping1.push_back( { 213, 155, 151, 187 } );
-  mapping1.push_back( { 213, 155, 151, 185 } );
-  mapping1.push_back( { 213, 155, 151, 180 } );
-  mapping1.push_back( { 213, 155, 151, 183 } );
-  mapping1.push_back( { 213, 155, 151, 186 } );
-  mapping1.push_back( { 213, 155, 151, 184 } );
-  mapping1.push_back( { 213, 155, 151, 181 } );
-  mapping1.push_back( { 213, 155, 151, 182 } );
-  
-  myDnsServer.addMapping("www.google.com.", mapping1);
-  ///               ///
+  fillZone(myDnsServer.getZone());
   
 	myDnsServer.start(inet);
 	std::cout << "<DNS SERVER> Listening on UDP port 53" << std::endl;
 	
 	std::cout << "Service out!" << std::endl;
 }
+
+#endif
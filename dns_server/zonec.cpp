@@ -0,0 +1,36 @@
+#include "dns_zone.hpp"
+#include "dns_zonefile.hpp"
+
+#include <iostream>
+#include <stdio.h>
+
+// zonec <zone file> <zone image> [origin]
+// compiles a master file into an image the server maps as it is
+int main(int argc, char** argv)
+{
+  if (argc < 3)
+  {
+    std::cout << "Usage: " << argv[0] << " <zone file> <zone image> [origin]" << std::endl;
+    return 1;
+  }
+  std::string origin = (argc > 3) ? argv[3] : ".";
+  
+  DNS_zone zone;
+  if (!DNS_zonefile::read(argv[1], origin, zone))
+    return 1;
+  zone.build();
+  
+  // write next to it, then rename over, so a server
+  // reloading the image never sees half of it
+  std::string image = argv[2];
+  std::string temp  = image + ".tmp";
+  
+  if (!zone.save(temp) || rename(temp.c_str(), image.c_str()) != 0)
+  {
+    std::cerr << image << ": can't write zone image" << std::endl;
+    remove(temp.c_str());
+    return 1;
+  }
+  std::cout << "Compiled " << zone.size() << " names into " << image << std::endl;
+  return 0;
+}
@@ -0,0 +1,311 @@
+#include "async_dns.hpp"
+
+#include <chrono>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+// retransmits back off exponentially up to this
+#define ASYNC_MAX_RTO_MS  2000
+// epoll tag of the UDP socket, the TCP pools are tagged with their nameserver
+#define ASYNC_UDP_TAG     UINT64_MAX
+// and of the one it replaced
+#define ASYNC_OLD_UDP_TAG (UINT64_MAX - 1)
+// queries go out from a new port this often, ms
+#define ASYNC_PORT_MS     1000
+// timer wheel resolution
+#define ASYNC_TICK_MS     10
+#define ASYNC_WHEEL_SLOTS 512
+
+AsyncDNS::AsyncDNS(int deadline_ms, int retransmit_ms)
+	: LinuxDNS(), queries(65536), timers(ASYNC_TICK_MS, ASYNC_WHEEL_SLOTS),
+	  active(0), generation(0),
+	  deadline_ms(deadline_ms), retransmit_ms(retransmit_ms),
+	  oldsock(-1), rotated(now_ms())
+{
+	this->epfd = epoll_create1(EPOLL_CLOEXEC);
+	timers.reset(now_ms());
+	// until a nameserver has answered, this is how long to give it
+	nameservers.set_initial_timeout(retransmit_ms);
+	
+	// we never block on the socket, epoll tells us when to read
+	fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+	
+	epoll_event ev;
+	ev.events   = EPOLLIN;
+	ev.data.u64 = ASYNC_UDP_TAG;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev) == SOCKET_ERROR)
+		printf("epoll_ctl error %d: %s\n", errno, strerror(errno));
+}
+AsyncDNS::~AsyncDNS()
+{
+	if (this->oldsock >= 0) close(this->oldsock);
+	close(this->epfd);
+}
+
+uint64_t AsyncDNS::now_ms()
+{
+	using namespace std::chrono;
+	return duration_cast<milliseconds>(
+			steady_clock::now().time_since_epoch()).count();
+}
+
+bool AsyncDNS::resolve(const std::string& hostname, callback_t callback,
+					   unsigned short qtype)
+{
+	// every outstanding lookup needs its own ID
+	if (active >= queries.size() - 1) return false;
+	
+	std::unique_ptr<query_t> q(new query_t);
+	do
+	{
+		q->length = q->req.createRequest(q->packet, hostname, qtype,
+										 DNS_CLASS_INET, flags, edns);
+	}
+	while (queries[q->req.getID()]);
+	
+	// a name that can't be asked for fails right away
+	if (q->length == 0)
+	{
+		callback(false, q->req);
+		return true;
+	}
+	
+	// a cached answer completes right away
+	if (cachedResponse(q->req))
+	{
+		callback(true, q->req);
+		return true;
+	}
+	
+	uint64_t now = now_ms();
+	q->callback = std::move(callback);
+	q->deadline = now + deadline_ms;
+	q->rto      = 0;
+	q->generation = ++generation;
+	q->overTCP  = false;
+	q->tcpServer = -1;
+	q->attempt.server = -1;
+	
+	uint16_t id = q->req.getID();
+	queries[id] = std::move(q);
+	active++;
+	
+	query_t& query = *queries[id];
+	if (!transmit(query))
+	{
+		complete(id, false);
+		return true;
+	}
+	timers.schedule(now + query.rto, (uint64_t) query.generation << 16 | id);
+	return true;
+}
+
+bool AsyncDNS::transmit(query_t& q)
+{
+	if (q.overTCP)
+		return tcpTo(q.tcpServer).send(q.packet, q.length);
+	
+	uint64_t now = now_ms();
+	if (now - rotated >= ASYNC_PORT_MS)
+		rotate(now);
+	
+	// the fastest nameserver, or when sending again, the next fastest
+	int previous = q.attempt.server;
+	int server   = nameservers.pick(previous);
+	
+	if (server < 0 || !sendTo(server, q.packet, q.length, q.attempt))
+	{
+		printf("Resolving %s... error %d: %s\n", q.req.getHostname().c_str(), errno, strerror(errno));
+		return false;
+	}
+	// another nameserver gets its own timeout, the same one is backed off from
+	if (server == previous)
+		q.rto = std::min(q.rto * 2, (unsigned) ASYNC_MAX_RTO_MS);
+	else
+		q.rto = nameservers.timeout(server);
+	return true;
+}
+
+void AsyncDNS::rotate(uint64_t now)
+{
+	// the kernel picks a random port when the first query goes
+	// out, which a forger has to guess as well as the ID
+	rotated = now;
+	socket_t fresh = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_UDP);
+	if (fresh == SOCKET_ERROR) return;
+	
+	// answers to what went out last time may still come in on
+	// the old one, anything sent before that is sent again
+	if (oldsock >= 0) close(oldsock);
+	oldsock = sock;
+	sock    = fresh;
+	
+	epoll_event ev;
+	ev.events   = EPOLLIN;
+	ev.data.u64 = ASYNC_OLD_UDP_TAG;
+	epoll_ctl(epfd, EPOLL_CTL_MOD, oldsock, &ev);
+	ev.data.u64 = ASYNC_UDP_TAG;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev) == SOCKET_ERROR)
+		printf("epoll_ctl error %d: %s\n", errno, strerror(errno));
+}
+
+void AsyncDNS::addedTCP(int server, DnsTcpPool& pool)
+{
+	// replies over TCP are waited for along with the rest,
+	// and known by the nameserver whose connections they came on
+	epoll_event ev;
+	ev.events   = EPOLLIN;
+	ev.data.u64 = server;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, pool.fd(), &ev) == SOCKET_ERROR)
+		printf("epoll_ctl error %d: %s\n", errno, strerror(errno));
+}
+
+void AsyncDNS::complete(uint16_t id, bool resolved)
+{
+	// take the query out before calling back, so the
+	// callback is free to submit new lookups
+	std::unique_ptr<query_t> q = std::move(queries[id]);
+	active--;
+	
+	if (q->callback) q->callback(resolved, q->req);
+}
+
+void AsyncDNS::expired(uint64_t cookie)
+{
+	uint16_t id  = cookie & 0xffff;
+	uint16_t gen = cookie >> 16;
+	
+	// the query was answered, or the ID has been reused since
+	query_t* q = queries[id].get();
+	if (q == nullptr || q->generation != gen) return;
+	
+	// it was lost, or the nameserver is too slow
+	if (!q->overTCP)
+		nameservers.failed(q->attempt.server);
+	
+	uint64_t now = now_ms();
+	if (now >= q->deadline || !transmit(*q))
+	{
+		complete(id, false);
+		return;
+	}
+	// never wait past the deadline
+	uint64_t when = std::min(now + q->rto, q->deadline);
+	timers.schedule(when, cookie);
+}
+
+void AsyncDNS::readReplies(socket_t udp)
+{
+	sockaddr_in from;
+	socklen_t fromlen = sizeof(from);
+	int readBytes;
+	
+	while ((readBytes = recvfrom(udp, buffer.data(), buffer.capacity(), 0, (struct sockaddr*) &from, &fromlen)) > 0)
+	{
+		fromlen = sizeof(from);
+		
+		// only accept replies from the nameservers we ask
+		int server = nameservers.find(from);
+		if (server < 0) continue;
+		accept(readBytes, server, false);
+	}
+}
+
+void AsyncDNS::readTCPReplies(int server)
+{
+	int readBytes;
+	
+	// queries on a lost connection are sent again when their timer runs out
+	while ((readBytes = tcp[server]->receive(buffer.data(), buffer.capacity(), 0)) != 0)
+	{
+		if (readBytes > 0)
+			accept(readBytes, server, true);
+	}
+}
+
+void AsyncDNS::accept(int readBytes, int server, bool overTCP)
+{
+	if (readBytes < (int) sizeof(dns_header_t))
+		return;
+	
+	uint16_t id = ((dns_header_t*) buffer.data())->id;
+	query_t* q = queries[id].get();
+	
+	if (q == nullptr || !q->req.matchesResponse(buffer.data(), readBytes))
+		return;
+	// over TCP, only from the nameserver it was asked
+	if (overTCP && (!q->overTCP || server != q->tcpServer))
+		return;
+	
+	// too big for UDP, from now on the query goes over TCP
+	if (((dns_header_t*) buffer.data())->tc && !overTCP)
+	{
+		if (q->overTCP) return;
+		q->overTCP = true;
+		DnsMetrics::count(DNS_UPSTREAM_TRUNCATED);
+		// TCP doesn't lose queries, only connections
+		q->rto = ASYNC_MAX_RTO_MS;
+		// with room for what comes back
+		buffer.reserve(DNS_BUFFER_LARGE);
+		q->tcpServer = sendTCP(server, q->packet, q->length);
+		if (q->tcpServer < 0)
+		{
+			complete(id, false);
+			return;
+		}
+		// the timer set for UDP would send it over TCP again,
+		// so it is left to go off unheard, and a new one set
+		q->generation = ++generation;
+		timers.schedule(std::min(now_ms() + q->rto, q->deadline),
+						(uint64_t) q->generation << 16 | id);
+		return;
+	}
+	if (!q->req.parseResponse(buffer.data(), readBytes))
+		return;
+	countAnswer(q->req);
+	
+	if (!overTCP)
+		nameservers.answered(q->attempt, server);
+	if (cache)
+		cache->store(q->req.getName(), q->req.getType(), q->req.getClass(), buffer.data(), readBytes);
+	
+	// for getResponse() from the callback
+	this->received = readBytes;
+	complete(id, true);
+}
+
+void AsyncDNS::process(int timeout_ms)
+{
+	// wake up for the next timer tick while there are timers pending
+	if (timers.size() && (timeout_ms < 0 || timeout_ms > (int) timers.tick_ms()))
+		timeout_ms = timers.tick_ms();
+	
+	epoll_event events[8];
+	int count = epoll_wait(epfd, events, 8, timeout_ms);
+	
+	if (count == SOCKET_ERROR && errno != EINTR)
+		printf("epoll_wait error %d: %s\n", errno, strerror(errno));
+	
+	for (int i = 0; i < count; i++)
+	{
+		if (events[i].data.u64 == ASYNC_UDP_TAG)
+			readReplies(sock);
+		else if (events[i].data.u64 == ASYNC_OLD_UDP_TAG)
+			readReplies(oldsock);
+		else
+			readTCPReplies(events[i].data.u64);
+	}
+	
+	timers.advance(now_ms(),
+	[this] (uint64_t cookie)
+	{
+		expired(cookie);
+	});
+}
+
+void AsyncDNS::run()
+{
+	while (active)
+		process(-1);
+}
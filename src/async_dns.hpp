@@ -0,0 +1,96 @@
+#ifndef ASYNC_DNS_HPP
+#define ASYNC_DNS_HPP
+
+#include "linux_dns.hpp"
+#include "timer_wheel.hpp"
+
+#include <functional>
+#include <memory>
+
+/**
+ * Non-blocking resolver driven by epoll
+ * 
+ * Lookups are submitted with resolve(), and complete through their
+ * callback from inside process()/run(). Every lookup is retransmitted
+ * until it is answered or its deadline passes, so a lost packet costs
+ * one retransmit instead of a hang. Retransmits go to the next fastest
+ * nameserver, after a timeout that adapts to how fast the last one has
+ * been answering, or back off exponentially when there is only one.
+ * Truncated answers are asked for again on pipelined TCP connections,
+ * which are retransmitted on the same schedule. Queries go out with
+ * random IDs, from a port that changes every so often, so an answer
+ * is hard to forge without seeing the query.
+ * 
+ * Not thread-safe: one AsyncDNS belongs to the thread running its loop.
+**/
+class AsyncDNS : public LinuxDNS
+{
+public:
+	// resolved is false when the lookup timed out or couldn't be sent,
+	// the response itself is in getResponse() until the callback returns
+	typedef std::function<void(bool resolved, DnsRequest& req)> callback_t;
+	
+	AsyncDNS(int deadline_ms = 5000, int retransmit_ms = 250);
+	~AsyncDNS();
+	
+	// start resolving hostname, returns false if there are
+	// too many lookups outstanding to take another one,
+	// a cached answer calls back before returning
+	bool resolve(const std::string& hostname, callback_t callback,
+				 unsigned short qtype = DNS_TYPE_A);
+	
+	// handle incoming replies and expired timers,
+	// waiting at most timeout_ms for something to happen
+	void process(int timeout_ms);
+	// run the event loop until all lookups have completed
+	void run();
+	
+	size_t outstanding() const
+	{
+		return this->active;
+	}
+	// the epoll descriptor, for embedding in another event loop
+	int fd() const
+	{
+		return this->epfd;
+	}
+	
+private:
+	struct query_t
+	{
+		DnsRequest req;
+		callback_t callback;
+		char       packet[DNS_REQUEST_MAX];
+		int        length;
+		uint64_t   deadline;  // ms, give up after this
+		unsigned   rto;       // ms, current retransmit timeout
+		uint16_t   generation;
+		bool       overTCP;   // truncated over UDP, now asked over TCP
+		int        tcpServer; // the nameserver asked over TCP
+		dns_attempt_t attempt;
+	};
+	
+	void readReplies(socket_t udp);
+	void readTCPReplies(int server);
+	void addedTCP(int server, DnsTcpPool& pool);
+	void accept(int readBytes, int server, bool overTCP);
+	void expired(uint64_t cookie);
+	void complete(uint16_t id, bool resolved);
+	bool transmit(query_t& q);
+	// send from a new port from now on
+	void rotate(uint64_t now);
+	static uint64_t now_ms();
+	
+	// outstanding lookups, indexed by DNS ID
+	std::vector<std::unique_ptr<query_t>> queries;
+	TimerWheel timers;
+	size_t   active;
+	uint16_t generation;
+	int      deadline_ms;
+	int      retransmit_ms;
+	int      epfd;
+	socket_t oldsock; // the one before, for answers still on their way
+	uint64_t rotated; // ms, when the socket was last changed
+};
+
+#endif
@@ -1,4 +1,8 @@
 #include "dns.hpp"
+#include "dns_view.hpp"
+
+#include <random>
+#include <sys/random.h>
 
 // cheap implementation of ntohs/htons
 unsigned short ntohs(unsigned short sh)
@@ -10,187 +14,472 @@ unsigned short ntohs(unsigned short sh)
 }
 #define htons ntohs
 
-// cheap implementation of inet_ntoa
-char* inet_ntoa_simple(unsigned address)
+// read big-endian fields out of rdata
+static uint16_t get16(const uint8_t* p)
 {
-	char* buffer = new char[16];
-	
-	unsigned char* B = (unsigned char*) &address;
-	sprintf(buffer, "%d.%d.%d.%d", B[0], B[1], B[2], B[3]);
+	return p[0] << 8 | p[1];
+}
+static uint32_t get32(const uint8_t* p)
+{
+	return (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+// decompress the name at offset into out, as long as it ends exactly at end,
+// returns the length of the name or -1
+static int readDataName(const char* buffer, int len, int offset, int end, char* out)
+{
+	if (DnsView::checkName((const unsigned char*) buffer, len, offset) != end)
+		return -1;
+	return DnsView::readName(buffer, len, offset, out, DNS_NAME_MAX);
+}
+
+// write an IPv6 address as 2001:db8::1, out must hold 40 bytes
+static void formatIPv6(const uint8_t* addr, char* out)
+{
+	// find the longest run of zero groups, to be written as ::
+	int best = -1, bestlen = 1;
+	for (int i = 0; i < 8; )
+	{
+		int j = i;
+		while (j < 8 && get16(addr + j * 2) == 0) j++;
+		if (j - i > bestlen)
+		{
+			best = i;
+			bestlen = j - i;
+		}
+		i = (j == i) ? i + 1 : j;
+	}
 	
-	return buffer;
+	int p = 0;
+	for (int i = 0; i < 8; i++)
+	{
+		if (i == best)
+		{
+			out[p++] = ':';
+			if (i == 0) out[p++] = ':';
+			i += bestlen - 1;
+			continue;
+		}
+		p += sprintf(out + p, "%x", get16(addr + i * 2));
+		if (i < 7) out[p++] = ':';
+	}
+	out[p] = '\0';
 }
 
-dns_rr_t::dns_rr_t(char*& reader, char* buffer)
+dns_rr_t::dns_rr_t(char*& reader, char* buffer, int len)
 {
-	int stop;
+	// the packet has been through DnsView::parse, so the owner
+	// name and the rdata are known to lie within it
+	int offset = reader - buffer;
+	
+	if (DnsView::readName(buffer, len, offset, this->name, sizeof(this->name)) < 0)
+		this->name[0] = '\0';
 	
-	this->name = readName(reader, buffer, stop);
-	reader += stop;
+	int pos = DnsView::checkName((const unsigned char*) buffer, len, offset);
+	memcpy(&this->resource, buffer + pos, sizeof(dns_rr_data_t));
+	pos += sizeof(dns_rr_data_t);
 	
-	this->resource = *(dns_rr_data_t*) reader;
-	reader += sizeof(dns_rr_data_t);
+	int rdlength = ntohs(resource.data_len);
+	readData(buffer, len, pos, rdlength);
 	
-	// if its an ipv4 address
-	if (ntohs(resource.type) == DNS_TYPE_A)
+	reader = buffer + pos + rdlength;
+}
+
+unsigned short dns_rr_t::type() const
+{
+	return ntohs(resource.type);
+}
+
+void dns_rr_t::readData(const char* buffer, int len, int offset, int rdlength)
+{
+	const uint8_t* data = (const uint8_t*) buffer + offset;
+	const int end = offset + rdlength;
+	dns_rdata_t& rd = this->rdata;
+	
+	rd.kind   = RDATA_OPAQUE;
+	rd.truncated = false;
+	rd.length = 0;
+	rd.text[0] = '\0';
+	
+	int n, m;
+	switch (type())
 	{
-		int len = ntohs(resource.data_len);
+	case DNS_TYPE_A:
+		if (rdlength != 4) break;
+		memcpy(rd.a, data, 4);
+		rd.kind = RDATA_A;
+		return;
+		
+	case DNS_TYPE_AAAA:
+		if (rdlength != 16) break;
+		memcpy(rd.aaaa, data, 16);
+		rd.kind = RDATA_AAAA;
+		return;
 		
-		this->rdata = std::string(reader, len);
-		reader += len;
+	case DNS_TYPE_CNAME:
+	case DNS_TYPE_NS:
+	case DNS_TYPE_PTR:
+		n = readDataName(buffer, len, offset, end, rd.text);
+		if (n < 0) break;
+		rd.length = n;
+		rd.kind = RDATA_NAME;
+		return;
+		
+	case DNS_TYPE_MX:
+		if (rdlength < 3) break;
+		n = readDataName(buffer, len, offset + 2, end, rd.text);
+		if (n < 0) break;
+		rd.mx.preference = get16(data);
+		rd.length = n;
+		rd.kind = RDATA_MX;
+		return;
+		
+	case DNS_TYPE_SRV:
+		if (rdlength < 7) break;
+		n = readDataName(buffer, len, offset + 6, end, rd.text);
+		if (n < 0) break;
+		rd.srv.priority = get16(data);
+		rd.srv.weight   = get16(data + 2);
+		rd.srv.port     = get16(data + 4);
+		rd.length = n;
+		rd.kind = RDATA_SRV;
+		return;
+		
+	case DNS_TYPE_SOA:
+		{
+			// mname and rname, followed by five 32-bit fields
+			const unsigned char* upacket = (const unsigned char*) buffer;
+			int mend = DnsView::checkName(upacket, len, offset);
+			if (mend < 0 || mend >= end) break;
+			int rend = DnsView::checkName(upacket, len, mend);
+			if (rend < 0 || end - rend != 20) break;
+			
+			n = DnsView::readName(buffer, len, offset, rd.text, DNS_NAME_MAX);
+			m = DnsView::readName(buffer, len, mend, rd.text + n + 1, DNS_NAME_MAX);
+			if (n < 0 || m < 0) break;
+			
+			const uint8_t* f = (const uint8_t*) buffer + rend;
+			rd.soa.serial  = get32(f);
+			rd.soa.refresh = get32(f + 4);
+			rd.soa.retry   = get32(f + 8);
+			rd.soa.expire  = get32(f + 12);
+			rd.soa.minimum = get32(f + 16);
+			rd.soa.rname = n + 1;
+			rd.length = n + 1 + m;
+			rd.kind = RDATA_SOA;
+		}
+		return;
+		
+	case DNS_TYPE_TXT:
+		rd.kind = RDATA_TXT;
+		break;
 	}
-	else
+	
+	// TXT, and anything we don't understand, is kept as it is
+	rd.length = rdlength;
+	if (rdlength > DNS_RDATA_MAX)
 	{
-		this->rdata = readName(reader, buffer, stop);
-		reader += stop;
+		rd.length = DNS_RDATA_MAX;
+		rd.truncated = true;
 	}
+	memcpy(rd.text, data, rd.length);
 }
 
-void dns_rr_t::print()
+void dns_rr_t::print() const
 {
-	printf("Name: %s ", name.c_str());
-	switch (ntohs(resource.type))
+	const dns_rdata_t& rd = this->rdata;
+	
+	printf("Name: %s ", name);
+	switch (rd.kind)
 	{
-	case DNS_TYPE_A:
+	case RDATA_A:
+		printf("has IPv4 address: %d.%d.%d.%d", rd.a[0], rd.a[1], rd.a[2], rd.a[3]);
+		break;
+	case RDATA_AAAA:
 		{
-			long* p    = (long*) rdata.c_str();
-			char* addr = inet_ntoa_simple(*p);
-			printf("has IPv4 address: %s", addr);
-			free(addr);
+			char addr[40];
+			formatIPv6(rd.aaaa, addr);
+			printf("has IPv6 address: %s", addr);
 		}
 		break;
-	case DNS_TYPE_ALIAS:
-		printf("has alias: %s", rdata.c_str());
+	case RDATA_NAME:
+		if (type() == DNS_TYPE_CNAME)
+			printf("has alias: %s", rd.name());
+		else if (type() == DNS_TYPE_NS)
+			printf("has authoritative nameserver : %s", rd.name());
+		else
+			printf("has domain name pointer: %s", rd.name());
 		break;
-	case DNS_TYPE_NS:
-		printf("has authoritative nameserver : %s", rdata.c_str());
+	case RDATA_MX:
+		printf("has mail exchanger: %u %s", rd.mx.preference, rd.name());
+		break;
+	case RDATA_SRV:
+		printf("has service location: %u %u %u %s",
+			rd.srv.priority, rd.srv.weight, rd.srv.port, rd.name());
+		break;
+	case RDATA_SOA:
+		printf("has start of authority: %s %s %u %u %u %u %u",
+			rd.mname(), rd.rname(), rd.soa.serial, rd.soa.refresh,
+			rd.soa.retry, rd.soa.expire, rd.soa.minimum);
+		break;
+	case RDATA_TXT:
+		{
+			printf("has text:");
+			const char* str;
+			int pos = 0, len;
+			while (rd.nextString(pos, str, len))
+				printf(" \"%.*s\"", len, str);
+		}
 		break;
 	default:
-		printf("has unknown resource type: %d", ntohs(resource.type));
+		printf("has unknown resource type: %d (%d bytes)",
+			type(), ntohs(resource.data_len));
 	}
+	if (rd.truncated) printf(" (truncated)");
 	printf("\n");
 }
 
-std::string dns_rr_t::readName(char* reader, char* buffer, int& count)
+// skip past a name in 3www6google3com0 format (or a pointer to one)
+static char* skipName(char* reader)
 {
-	std::string name(256, '\0');
-	unsigned p = 0;
-	unsigned offset = 0;
-	bool jumped = false;
-	
-	count = 1;
 	unsigned char* ureader = (unsigned char*) reader;
 	
 	while (*ureader)
 	{
 		if (*ureader >= 192)
-		{
-			offset = (*ureader) * 256 + *(ureader+1) - 49152; // = 11000000 00000000
-			ureader = (unsigned char*) buffer + offset - 1;
-			jumped = true; // we have jumped to another location so counting wont go up!
-		}
-		else
-		{
-			name[p++] = *ureader;
-		}
-		ureader++;
-		
-		// if we havent jumped to another location then we can count up
-		if (jumped == false) count++;
+			return (char*) ureader + 2;
+		ureader += *ureader + 1;
 	}
-	name.resize(p);
+	return (char*) ureader + 1;
+}
+
+DnsRequestBuilder::DnsRequestBuilder(char* buffer, int size, unsigned short id,
+									 unsigned short flags)
+	: buffer(buffer), size(size), pos(0), encoder(buffer, size)
+{
+	if (size < (int) sizeof(dns_header_t)) return;
+	
+	memset(buffer, 0, sizeof(dns_header_t));
+	dns_header_t* dns = (dns_header_t*) buffer;
+	dns->id = id;
+	// flags are in network order, the header bits are laid out to match
+	buffer[2] = (flags >> 8) & 0x79; // opcode and rd, qr is always 0
+	buffer[3] = flags & 0x30;        // ad and cd
+	
+	this->pos = sizeof(dns_header_t);
+}
+
+bool DnsRequestBuilder::addQuestion(const char* name, unsigned short qtype,
+									unsigned short qclass)
+{
+	DnsName wire;
+	return wire.parse(name) && addQuestion(wire, qtype, qclass);
+}
+
+bool DnsRequestBuilder::addQuestion(const DnsName& name, unsigned short qtype,
+									unsigned short qclass)
+{
+	dns_header_t* dns = (dns_header_t*) buffer;
+	// a short buffer, or questions after the OPT record
+	if (pos == 0 || dns->add_count || name.length() == 0) return false;
+	
+	int namelen = encoder.write(pos, name, size - pos - sizeof(dns_question_t));
+	if (namelen < 0) return false;
+	
+	unsigned char* q = (unsigned char*) buffer + pos + namelen;
+	q[0] = qtype >> 8;
+	q[1] = qtype;
+	q[2] = qclass >> 8;
+	q[3] = qclass;
+	
+	pos += namelen + sizeof(dns_question_t);
+	dns->q_count = htons(ntohs(dns->q_count) + 1);
+	return true;
+}
+
+bool DnsRequestBuilder::addEDNS(unsigned short payload, unsigned short flags)
+{
+	dns_header_t* dns = (dns_header_t*) buffer;
+	// root name, type, payload size as class, extended rcode,
+	// version and flags as ttl, and no options
+	const int OPT_SIZE = 1 + sizeof(dns_rr_data_t);
+	if (pos == 0 || dns->add_count || size - pos < OPT_SIZE) return false;
 	
-	// number of steps we actually moved forward in the packet
-	if (jumped)
-		count++;
+	unsigned char* opt = (unsigned char*) buffer + pos;
+	memset(opt, 0, OPT_SIZE);
+	opt[2] = DNS_TYPE_OPT;
+	opt[3] = payload >> 8;
+	opt[4] = payload;
+	opt[7] = flags >> 8;
+	opt[8] = flags;
+	
+	pos += OPT_SIZE;
+	dns->add_count = htons(1);
+	return true;
+}
+
+int DnsRequestBuilder::encodeName(const char* name, char* out, int outlen)
+{
+	DnsName wire;
+	if (!wire.parse(name) || wire.length() > outlen) return -1;
 	
-	// now convert 3www6google3com0 to www.google.com
-	int len = p; // same as name.size()
-	int i;
-	for(i = 0; i < len; i++)
+	memcpy(out, wire.data(), wire.length());
+	return wire.length();
+}
+
+DnsRequest::DnsRequest()
+	: id(0), qtype(0), qclass(0), flags(0), edns(0),
+	  answers(&arena), auth(&arena), addit(&arena)
+{
+	memset(&this->header, 0, sizeof(dns_header_t));
+}
+
+DnsRequest::DnsRequest(const DnsRequest& other)
+	: DnsRequest()
+{
+	*this = other;
+}
+
+DnsRequest& DnsRequest::operator=(const DnsRequest& other)
+{
+	if (this == &other) return *this;
+	
+	this->hostname = other.hostname;
+	this->qname  = other.qname;
+	this->id     = other.id;
+	this->qtype  = other.qtype;
+	this->qclass = other.qclass;
+	this->flags  = other.flags;
+	this->edns   = other.edns;
+	this->header = other.header;
+	
+	// the records go into our own arena
+	clearRecords();
+	this->answers.assign(other.answers.begin(), other.answers.end());
+	this->auth.assign(other.auth.begin(), other.auth.end());
+	this->addit.assign(other.addit.begin(), other.addit.end());
+	return *this;
+}
+
+void DnsRequest::clearRecords()
+{
+	// let go of the storage before the arena takes it back
+	dns_records_t(&arena).swap(this->answers);
+	dns_records_t(&arena).swap(this->auth);
+	dns_records_t(&arena).swap(this->addit);
+	this->arena.reset();
+}
+
+unsigned short DnsRequest::generateID()
+{
+	// a forged answer has to guess the ID, so it mustn't follow
+	// from the last one, and a batch saves a system call each
+	static thread_local unsigned short ids[DNS_ID_BATCH];
+	static thread_local int left = 0;
+	
+	if (left == 0)
 	{
-		p = name[i];
-		
-		for(unsigned j = 0; j < p; j++)
+		if (getrandom(ids, sizeof(ids), 0) != (ssize_t) sizeof(ids))
 		{
-			name[i] = name[i+1];
-			i++;
+			std::random_device random;
+			for (auto& id : ids) id = random();
 		}
-		name[i] = '.';
+		left = DNS_ID_BATCH;
 	}
-	name[i - 1] = '\0'; // remove the last dot
-	return name;
-	
-} // readName()
+	return ids[--left];
+}
 
-int DnsRequest::createRequest(char* buffer, const std::string& hostname)
+int DnsRequest::createRequest(char* buffer, const std::string& hostname,
+							  unsigned short qtype, unsigned short qclass,
+							  unsigned short flags, unsigned short edns)
 {
 	this->hostname = hostname;
-	this->answers.clear();
-	this->auth.clear();
-	this->addit.clear();
+	this->id     = generateID();
+	if (!qname.parse(hostname.c_str()))
+		qname = DnsName();
+	this->qtype  = qtype;
+	this->qclass = qclass;
+	this->flags  = flags;
+	this->edns   = edns;
+	clearRecords();
+	memset(&this->header, 0, sizeof(dns_header_t));
 	
+	return writeRequest(buffer);
+}
+
+int DnsRequest::writeRequest(char* buffer) const
+{
 	// fill with DNS request data
-	dns_header_t* dns = (dns_header_t*) buffer;
-	dns->id = generateID();
-	dns->qr = DNS_QR_QUERY;
-	dns->opcode = 0;       // standard query
-	dns->aa = 0;           // not Authoritative
-	dns->tc = DNS_TC_NONE; // not truncated
-	dns->rd = 1; // recursion Desired
-	dns->ra = 0; // recursion not available
-	dns->z  = DNS_Z_RESERVED;
-	dns->ad = 0;
-	dns->cd = 0;
-	dns->rcode = dns_resp_code_t::NO_ERROR;
-	dns->q_count = htons(1); // only 1 question
-	dns->ans_count  = 0;
-	dns->auth_count = 0;
-	dns->add_count  = 0;
-	
-    // point to the query portion
-	char* qname = buffer + sizeof(dns_header_t);
-	
-	// convert host to dns name format
-	dnsNameFormat(qname);
-	// length of dns name
-	int namelen = strlen(qname) + 1;
-	
-	// set question to Internet A record
-	this->qinfo   = (dns_question_t*) (qname + namelen);
-	qinfo->qtype  = htons(DNS_TYPE_A); // ipv4 address
-	qinfo->qclass = htons(DNS_CLASS_INET);
+	DnsRequestBuilder builder(buffer, DNS_REQUEST_MAX, this->id, this->flags);
+	
+	if (!builder.addQuestion(qname, qtype, qclass))
+		return 0;
+	if (edns && !builder.addEDNS(edns))
+		return 0;
 	
 	// return the size of the message to be sent
-	return sizeof(dns_header_t) + namelen + sizeof(dns_question_t);
+	return builder.length();
 }
 
 // parse received message (as put into buffer)
-bool DnsRequest::parseResponse(char* buffer)
+bool DnsRequest::parseResponse(char* buffer, int len)
 {
+	// refuse anything malformed before the parser gets to it
+	DnsView view;
+	if (!view.parse(buffer, len)) return false;
+	
 	dns_header_t* dns = (dns_header_t*) buffer;
+	this->header = *dns;
+	
+	// the view checked the counts, so each section is
+	// allocated once, at its final size
+	clearRecords();
+	this->answers.reserve(ntohs(dns->ans_count));
+	this->auth.reserve(ntohs(dns->auth_count));
+	this->addit.reserve(ntohs(dns->add_count));
 	
 	// move ahead of the dns header and the query field
-	char* reader = ((char*) this->qinfo) + sizeof(dns_question_t);
+	char* reader = buffer + sizeof(dns_header_t);
+	for (int i = 0; i < ntohs(dns->q_count); i++)
+		reader = skipName(reader) + sizeof(dns_question_t);
 	
 	// parse answers
     for(int i = 0; i < ntohs(dns->ans_count); i++)
-		answers.emplace_back(reader, buffer);
+		answers.emplace_back(reader, buffer, len);
 	
     // parse authorities
     for (int i = 0; i < ntohs(dns->auth_count); i++)
-        auth.emplace_back(reader, buffer);
+        auth.emplace_back(reader, buffer, len);
 	
     // parse additional
     for (int i = 0; i < ntohs(dns->add_count); i++)
-		addit.emplace_back(reader, buffer);
+		addit.emplace_back(reader, buffer, len);
 	
 	return true;
 }
 
-void DnsRequest::print(char* buffer)
+bool DnsRequest::matchesResponse(const char* buffer, int len) const
 {
-	dns_header_t* dns = (dns_header_t*) buffer;
+	const dns_header_t* dns = (const dns_header_t*) buffer;
+	
+	if (len < (int) sizeof(dns_header_t)) return false;
+	if (dns->id != this->id || dns->qr != DNS_QR_RESPONSE) return false;
+	if (ntohs(dns->q_count) != 1) return false;
+	
+	// the question is echoed back, compare it in wire format
+	DnsName name;
+	int pos = name.read(buffer, len, sizeof(dns_header_t));
+	if (pos < 0 || name != this->qname) return false;
+	
+	if (len - pos < (int) sizeof(dns_question_t)) return false;
+	const unsigned char* q = (const unsigned char*) buffer + pos;
+	return (q[0] << 8 | q[1]) == this->qtype &&
+		   (q[2] << 8 | q[3]) == this->qclass;
+}
+
+void DnsRequest::print()
+{
+	dns_header_t* dns = &this->header;
 	
 	printf(" %d questions\n", ntohs(dns->q_count));
 	printf(" %d answers\n",   ntohs(dns->ans_count));
@@ -211,26 +500,3 @@ void DnsRequest::print(char* buffer)
 	
 	printf("\n");
 }
-
-// convert www.google.com to 3www6google3com
-void DnsRequest::dnsNameFormat(char* dns)
-{
-    int lock = 0;
-	
-    std::string copy = this->hostname + ".";
-    int len = copy.size();
-    
-    for(int i = 0; i < len; i++)
-    {
-        if (copy[i] == '.')
-        {
-            *dns++ = i - lock;
-            for(; lock < i; lock++)
-            {
-                *dns++ = copy[lock];
-            }
-            lock++;
-        }
-    }
-    *dns++ = '\0';
-}
@@ -35,6 +35,10 @@
 #include <string>
 #include <vector>
 
+#include "dns_buffer.hpp"
+#include "dns_name.hpp"
+
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -86,13 +90,34 @@ struct dns_rr_data_t // resource record data
 #define DNS_TYPE_A    1  // A record
 #define DNS_TYPE_NS   2  // respect mah authoritah
 #define DNS_TYPE_ALIAS 5 // name alias
+#define DNS_TYPE_CNAME DNS_TYPE_ALIAS
 
 #define DNS_TYPE_SOA  6  // start of authority zone
 #define DNS_TYPE_PTR 12  // domain name pointer
 #define DNS_TYPE_MX  15  // mail routing information
+#define DNS_TYPE_TXT 16  // text strings
+#define DNS_TYPE_AAAA 28 // IPv6 address
+#define DNS_TYPE_SRV 33  // service location
+#define DNS_TYPE_OPT 41  // EDNS(0) pseudo-record
+#define DNS_TYPE_ANY 255 // all records
 
 #define DNS_Z_RESERVED   0
 
+// header flags for requests, as they lie in the third and fourth byte
+#define DNS_FLAG_RD  0x0100 // recursion desired
+#define DNS_FLAG_AD  0x0020 // authenticated data
+#define DNS_FLAG_CD  0x0010 // checking disabled
+
+// the OPT record's DO bit, asking for DNSSEC records
+#define DNS_EDNS_DO  0x8000
+
+// a request with one question and an OPT record always fits this
+#define DNS_REQUEST_MAX  512
+// random IDs drawn from the kernel at a time
+#define DNS_ID_BATCH     128
+// UDP payload size to advertise, small enough to avoid IP fragmentation
+#define DNS_EDNS_PAYLOAD 1232
+
 enum dns_resp_code_t
 {
 	NO_ERROR     = 0,
@@ -103,47 +128,238 @@ enum dns_resp_code_t
 	OP_REFUSED   = 5, // for political reasons
 };
 
+// longest name in dotted form, including the terminating zero
+#define DNS_NAME_MAX   256
+// room for the rdata kept with a record: two names in dotted form
+// (the SOA case), or the raw bytes of TXT and unknown records
+#define DNS_RDATA_MAX  512
+
+// how the rdata of a record was decoded
+enum dns_rdata_kind_t
+{
+	RDATA_OPAQUE = 0, // raw bytes, for unknown or malformed records
+	RDATA_A,
+	RDATA_AAAA,
+	RDATA_NAME,       // CNAME, NS and PTR
+	RDATA_MX,
+	RDATA_TXT,
+	RDATA_SOA,
+	RDATA_SRV,
+};
+
+/**
+ * Decoded rdata, fixed size and without allocations
+ * 
+ * The numeric fields share a union, while names and bytes go in text:
+ * one name for CNAME, NS, PTR, MX and SRV, mname and rname back to back
+ * for SOA, and the rdata as it lies in the packet for TXT and opaque
+ * records. Names are in dotted form and zero-terminated. Rdata too big
+ * for text is cut short, and marked truncated.
+**/
+struct dns_rdata_t
+{
+	uint8_t  kind;      // a dns_rdata_kind_t
+	bool     truncated; // text holds only the first part of the rdata
+	uint16_t length;    // bytes used in text
+	
+	union
+	{
+		uint8_t a[4];     // network byte order
+		uint8_t aaaa[16];
+		struct
+		{
+			uint16_t preference;
+		} mx;
+		struct
+		{
+			uint16_t priority;
+			uint16_t weight;
+			uint16_t port;
+		} srv;
+		struct
+		{
+			uint32_t serial;
+			uint32_t refresh;
+			uint32_t retry;
+			uint32_t expire;
+			uint32_t minimum;
+			uint16_t rname; // offset of rname in text
+		} soa;
+	};
+	char text[DNS_RDATA_MAX];
+	
+	// the name of CNAME, NS, PTR, MX (exchange) and SRV (target) records
+	const char* name() const
+	{
+		return this->text;
+	}
+	const char* mname() const
+	{
+		return this->text;
+	}
+	const char* rname() const
+	{
+		return this->text + soa.rname;
+	}
+	// walk the character-strings of a TXT record, starting with pos = 0,
+	// returns false when there are no more of them
+	bool nextString(int& pos, const char*& str, int& len) const
+	{
+		if (pos >= this->length) return false;
+		
+		len = (uint8_t) text[pos];
+		if (len > this->length - pos - 1) len = this->length - pos - 1;
+		str = text + pos + 1;
+		pos += len + 1;
+		return true;
+	}
+};
+
 struct dns_rr_t // resource record
 {
-	dns_rr_t(char*& reader, char* buffer);
+	dns_rr_t(char*& reader, char* buffer, int len);
+	
+	char          name[DNS_NAME_MAX]; // the owner, in dotted form
+	dns_rr_data_t resource;
+	dns_rdata_t   rdata;
+	
+	unsigned short type() const;
+	void print() const;
+	
+private:
+	// decode the rdata at offset according to the record type
+	void readData(const char* buffer, int len, int offset, int rdlength);
+};
+
+/**
+ * Builds a request straight into a caller-supplied buffer
+ * 
+ * Questions are added one after another, followed by an optional
+ * EDNS(0) OPT record. Names are validated and encoded as they are
+ * copied, without allocating, and compressed against the questions
+ * before them. A name that isn't valid, or anything that doesn't fit
+ * the buffer, fails the call and leaves the request as it was.
+**/
+class DnsRequestBuilder
+{
+public:
+	DnsRequestBuilder(char* buffer, int size, unsigned short id,
+					  unsigned short flags = DNS_FLAG_RD);
+	
+	bool addQuestion(const char* name, unsigned short qtype,
+					 unsigned short qclass = DNS_CLASS_INET);
+	bool addQuestion(const DnsName& name, unsigned short qtype,
+					 unsigned short qclass = DNS_CLASS_INET);
+	// advertise a UDP payload size, which must come after the questions
+	bool addEDNS(unsigned short payload, unsigned short flags = 0);
+	
+	// bytes of request written so far
+	int length() const
+	{
+		return this->pos;
+	}
 	
-    std::string name;
-    std::string rdata;
-    dns_rr_data_t resource;
-    
-    void print();
+	// encode www.google.com (a trailing dot is fine) as 3www6google3com0
+	// into out, returns the bytes written or -1 if the name is not valid
+	// or doesn't fit in outlen bytes
+	static int encodeName(const char* name, char* out, int outlen);
 	
 private:
-	// read names in 3www6google3com format
-	std::string readName(char* reader, char* buffer, int& count);
+	char* buffer;
+	int   size;
+	int   pos;
+	DnsNameEncoder encoder;
 };
 
+// the records of a section, which live in the arena of the response
+// they were parsed from (a copy of them lives on the heap)
+typedef std::vector<dns_rr_t, DnsArenaAllocator<dns_rr_t>> dns_records_t;
+
 class DnsRequest
 {
 public:
-	int  createRequest(char* buffer, const std::string& hostname);
-	bool parseResponse(char* buffer);
-	void print(char* buffer);
+	DnsRequest();
+	DnsRequest(const DnsRequest& other);
+	DnsRequest& operator=(const DnsRequest& other);
+	
+
+	// write a request for hostname into buffer, which must hold
+	// DNS_REQUEST_MAX bytes, edns is the UDP payload size to
+	// advertise or 0 for none, returns the size of the request
+	// or 0 if hostname is not a valid name
+	int  createRequest(char* buffer, const std::string& hostname,
+					   unsigned short qtype  = DNS_TYPE_A,
+					   unsigned short qclass = DNS_CLASS_INET,
+					   unsigned short flags  = DNS_FLAG_RD,
+					   unsigned short edns   = 0);
+	// write the request made by createRequest() again, with the same
+	// ID, for asking another way (say over TCP), returns its size
+	int  writeRequest(char* buffer) const;
+	// parse a response of len bytes, false if it is malformed
+	bool parseResponse(char* buffer, int len);
+	// true if buffer holds the reply to this request (same ID and question)
+	bool matchesResponse(const char* buffer, int len) const;
+	void print();
 	
 	const std::string& getHostname() const
 	{
 		return this->hostname;
 	}
-	
-private:
-	unsigned short generateID()
+	// the same, in wire format
+	const DnsName& getName() const
+	{
+		return this->qname;
+	}
+	unsigned short getID() const
+	{
+		return this->id;
+	}
+	unsigned short getType() const
+	{
+		return this->qtype;
+	}
+	unsigned short getClass() const
+	{
+		return this->qclass;
+	}
+	// the header of the parsed response
+	const dns_header_t& getHeader() const
+	{
+		return this->header;
+	}
+	const dns_records_t& getAnswers() const
+	{
+		return this->answers;
+	}
+	const dns_records_t& getAuthority() const
+	{
+		return this->auth;
+	}
+	const dns_records_t& getAdditional() const
 	{
-		static unsigned short id = 0;
-		return ++id;
+		return this->addit;
 	}
-	void dnsNameFormat(char* dns);
+	
+	// a random ID, one that whoever didn't see the query can't guess
+	static unsigned short generateID();
+	
+private:
+	// drop the records of the last response, and their memory
+	void clearRecords();
 	
 	std::string hostname;
-	dns_question_t* qinfo;
+	DnsName qname;
+	unsigned short id;
+	unsigned short qtype;
+	unsigned short qclass;
+	unsigned short flags;
+	unsigned short edns;
+	dns_header_t header; // header of the parsed response
 	
-    std::vector<dns_rr_t> answers;
-    std::vector<dns_rr_t> auth;
-    std::vector<dns_rr_t> addit;
+	DnsArena arena; // the records are allocated from
+    dns_records_t answers;
+    dns_records_t auth;
+    dns_records_t addit;
 };
 
 #endif
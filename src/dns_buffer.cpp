@@ -0,0 +1,199 @@
+#include "dns_buffer.hpp"
+
+#include <mutex>
+#include <vector>
+
+// the two sizes buffers come in
+#define TIER_SMALL  0
+#define TIER_LARGE  1
+#define TIERS       2
+
+static const int tier_size[TIERS] = { DNS_BUFFER_SMALL, DNS_BUFFER_LARGE };
+
+// free buffers of one size no thread is keeping
+struct depot_t
+{
+	std::mutex lock;
+	std::vector<char*> free;
+};
+
+static depot_t* depots()
+{
+	// never destroyed, buffers may come back while the program exits
+	static depot_t* depot = new depot_t[TIERS];
+	return depot;
+}
+
+// free buffers kept by one thread
+struct cache_t
+{
+	char* free[TIERS][DNS_BUFFER_CACHED];
+	int   count[TIERS];
+	
+	cache_t()
+	{
+		count[TIER_SMALL] = count[TIER_LARGE] = 0;
+	}
+	~cache_t();
+	
+	// move buffers between the cache and the depot
+	void refill(int tier);
+	void flush(int tier, int keep);
+};
+
+static thread_local cache_t cache;
+// set once the thread's cache is gone, buffers
+// given back after that go to the depot directly
+static thread_local bool cache_gone = false;
+
+cache_t::~cache_t()
+{
+	flush(TIER_SMALL, 0);
+	flush(TIER_LARGE, 0);
+	cache_gone = true;
+}
+
+void cache_t::refill(int tier)
+{
+	depot_t& depot = depots()[tier];
+	{
+		std::lock_guard<std::mutex> guard(depot.lock);
+		while (count[tier] < DNS_BUFFER_CACHED / 2 && !depot.free.empty())
+		{
+			free[tier][count[tier]++] = depot.free.back();
+			depot.free.pop_back();
+		}
+	}
+	if (count[tier]) return;
+	
+	// none to be had, so carve up a new slab (large buffers
+	// are bigger than a slab, and get one each)
+	int size = tier_size[tier];
+	int n    = (size < DNS_BUFFER_SLAB) ? DNS_BUFFER_SLAB / size : 1;
+	char* slab = new char[n * size];
+	
+	for (int i = 0; i < n && i < DNS_BUFFER_CACHED; i++)
+		free[tier][count[tier]++] = slab + i * size;
+	if (n > DNS_BUFFER_CACHED)
+	{
+		std::lock_guard<std::mutex> guard(depot.lock);
+		for (int i = DNS_BUFFER_CACHED; i < n; i++)
+			depot.free.push_back(slab + i * size);
+	}
+}
+
+void cache_t::flush(int tier, int keep)
+{
+	depot_t& depot = depots()[tier];
+	std::lock_guard<std::mutex> guard(depot.lock);
+	
+	while (count[tier] > keep)
+		depot.free.push_back(free[tier][--count[tier]]);
+}
+
+char* DnsBuffer::acquire(int size, int& capacity)
+{
+	if (size > DNS_BUFFER_LARGE)
+	{
+		capacity = size;
+		return new char[size];
+	}
+	int tier = (size > DNS_BUFFER_SMALL) ? TIER_LARGE : TIER_SMALL;
+	capacity = tier_size[tier];
+	
+	if (cache_gone)
+	{
+		depot_t& depot = depots()[tier];
+		std::lock_guard<std::mutex> guard(depot.lock);
+		if (!depot.free.empty())
+		{
+			char* buffer = depot.free.back();
+			depot.free.pop_back();
+			return buffer;
+		}
+		return new char[capacity];
+	}
+	if (cache.count[tier] == 0) cache.refill(tier);
+	return cache.free[tier][--cache.count[tier]];
+}
+
+void DnsBuffer::recycle(char* buffer, int capacity)
+{
+	if (capacity > DNS_BUFFER_LARGE)
+	{
+		delete[] buffer;
+		return;
+	}
+	int tier = (capacity > DNS_BUFFER_SMALL) ? TIER_LARGE : TIER_SMALL;
+	
+	if (cache_gone)
+	{
+		depot_t& depot = depots()[tier];
+		std::lock_guard<std::mutex> guard(depot.lock);
+		depot.free.push_back(buffer);
+		return;
+	}
+	// keep half, so the next few go either way without the depot
+	if (cache.count[tier] == DNS_BUFFER_CACHED)
+		cache.flush(tier, DNS_BUFFER_CACHED / 2);
+	cache.free[tier][cache.count[tier]++] = buffer;
+}
+
+void DnsBuffer::reserve(int size)
+{
+	if (this->buffer && this->bytes >= size) return;
+	
+	release();
+	this->buffer = acquire(size, this->bytes);
+}
+
+void DnsBuffer::release()
+{
+	if (this->buffer == nullptr) return;
+	
+	recycle(this->buffer, this->bytes);
+	this->buffer = nullptr;
+	this->bytes  = 0;
+}
+
+// in front of every chunk of an arena
+struct chunk_t
+{
+	char* prev; // the chunk cut up before this one
+	int   size;
+};
+
+void* DnsArena::allocate(size_t bytes, size_t align)
+{
+	size_t start = (used + align - 1) & ~(align - 1);
+	
+	if (this->chunk == nullptr || start + bytes > this->size)
+	{
+		// a new chunk, with room for this at least
+		int capacity;
+		char* next = DnsBuffer::acquire(sizeof(chunk_t) + bytes + align, capacity);
+		
+		chunk_t* header = (chunk_t*) next;
+		header->prev = this->chunk;
+		header->size = capacity;
+		
+		this->chunk = next;
+		this->size  = capacity;
+		start = (sizeof(chunk_t) + align - 1) & ~(align - 1);
+	}
+	this->used = start + bytes;
+	return this->chunk + start;
+}
+
+void DnsArena::reset()
+{
+	while (this->chunk)
+	{
+		chunk_t* header = (chunk_t*) this->chunk;
+		char* prev = header->prev;
+		DnsBuffer::recycle(this->chunk, header->size);
+		this->chunk = prev;
+	}
+	this->used = 0;
+	this->size = 0;
+}
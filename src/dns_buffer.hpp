@@ -0,0 +1,165 @@
+#ifndef DNS_BUFFER_HPP
+#define DNS_BUFFER_HPP
+
+#include <stddef.h>
+
+// buffers for UDP, with room to spare over any EDNS payload we advertise
+#define DNS_BUFFER_SMALL   4096
+// buffers for any message, with the two byte length TCP puts in front
+#define DNS_BUFFER_LARGE   (2 + 65535)
+// small buffers are carved out of slabs of this many bytes
+#define DNS_BUFFER_SLAB    (64 * 1024)
+// free buffers of each size a thread keeps to itself
+#define DNS_BUFFER_CACHED  16
+
+/**
+ * A packet buffer, from a pool
+ *
+ * Buffers come in two sizes: small ones, for UDP, and large ones, for
+ * TCP and large EDNS payloads. Each thread keeps a few free buffers of
+ * each size to itself, so taking one and giving it back doesn't lock
+ * or allocate, and the rest wait in a list shared by every thread.
+ * Memory in the pool is never given back, so a steady load settles on
+ * the buffers it needs and stops faulting in new pages. Buffers larger
+ * than the large size come straight from the heap.
+ *
+ * The buffer goes back to the pool when its handle is destroyed, and
+ * handles can be moved, but not copied.
+**/
+class DnsBuffer
+{
+public:
+	DnsBuffer() : buffer(nullptr), bytes(0) {}
+	// a buffer of at least size bytes
+	explicit DnsBuffer(int size) : buffer(nullptr), bytes(0)
+	{
+		reserve(size);
+	}
+	~DnsBuffer()
+	{
+		release();
+	}
+	
+	DnsBuffer(DnsBuffer&& other) : buffer(other.buffer), bytes(other.bytes)
+	{
+		other.buffer = nullptr;
+		other.bytes  = 0;
+	}
+	DnsBuffer& operator=(DnsBuffer&& other)
+	{
+		if (this != &other)
+		{
+			release();
+			this->buffer = other.buffer;
+			this->bytes  = other.bytes;
+			other.buffer = nullptr;
+			other.bytes  = 0;
+		}
+		return *this;
+	}
+	DnsBuffer(const DnsBuffer&) = delete;
+	DnsBuffer& operator=(const DnsBuffer&) = delete;
+	
+	char* data() const
+	{
+		return this->buffer;
+	}
+	// bytes in the buffer, 0 for none at all
+	int capacity() const
+	{
+		return this->bytes;
+	}
+	
+	// make sure there is a buffer of at least size bytes, whatever
+	// was in it is lost if a bigger one has to be taken
+	void reserve(int size);
+	// give the buffer back to the pool, leaving none
+	void release();
+	
+	// a buffer of at least size bytes straight from the pool, and
+	// how big it really is, which is what it must be given back with
+	static char* acquire(int size, int& capacity);
+	static void  recycle(char* buffer, int capacity);
+
+private:
+	char* buffer;
+	int   bytes;
+};
+
+/**
+ * Memory for what lives exactly as long as the packet it came from
+ *
+ * Allocations are cut one after another out of pooled buffers, and
+ * all given back at once when the arena is reset or destroyed, so a
+ * parsed response costs a few pointer bumps instead of a trip to the
+ * heap per record.
+**/
+class DnsArena
+{
+public:
+	DnsArena() : chunk(nullptr), used(0), size(0) {}
+	~DnsArena()
+	{
+		reset();
+	}
+	
+	DnsArena(const DnsArena&) = delete;
+	DnsArena& operator=(const DnsArena&) = delete;
+	
+	// bytes aligned to align, which must be a power of two up to 16
+	void* allocate(size_t bytes, size_t align);
+	// everything allocated so far goes back to the pool at once
+	void  reset();
+
+private:
+	char*  chunk; // the one being cut up, with the one before in front
+	size_t used;
+	size_t size;
+};
+
+/**
+ * Standard allocator for containers that live in an arena
+ *
+ * Nothing is freed until the arena is reset, so it suits containers
+ * that are filled once and then read. A copy of the container is
+ * allocated from the heap, and outlives the arena. Without an arena
+ * it is the heap all along.
+**/
+template <typename T>
+struct DnsArenaAllocator
+{
+	typedef T value_type;
+	
+	DnsArenaAllocator(DnsArena* arena = nullptr) : arena(arena) {}
+	template <typename U>
+	DnsArenaAllocator(const DnsArenaAllocator<U>& other) : arena(other.arena) {}
+	
+	T* allocate(size_t n)
+	{
+		if (arena) return (T*) arena->allocate(n * sizeof(T), alignof(T));
+		return (T*) ::operator new(n * sizeof(T));
+	}
+	void deallocate(T* p, size_t)
+	{
+		if (arena == nullptr) ::operator delete(p);
+	}
+	DnsArenaAllocator select_on_container_copy_construction() const
+	{
+		return DnsArenaAllocator();
+	}
+	
+	template <typename U>
+	bool operator== (const DnsArenaAllocator<U>& other) const
+	{
+		return arena == other.arena;
+	}
+	template <typename U>
+	bool operator!= (const DnsArenaAllocator<U>& other) const
+	{
+		return arena != other.arena;
+	}
+	
+	DnsArena* arena;
+};
+
+#endif
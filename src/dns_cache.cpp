@@ -0,0 +1,223 @@
+#include "dns_cache.hpp"
+#include "dns_metrics.hpp"
+#include "dns_simd.hpp"
+#include "dns_view.hpp"
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <functional>
+
+// rough bookkeeping cost of an entry, on top of its strings
+#define CACHE_ENTRY_OVERHEAD  128
+
+static int64_t now_seconds()
+{
+	using namespace std::chrono;
+	return duration_cast<seconds>(
+			steady_clock::now().time_since_epoch()).count();
+}
+
+DnsCache::DnsCache(size_t max_bytes, unsigned shards)
+	: shards(shards ? shards : 1)
+{
+	this->shard_bytes = max_bytes / this->shards.size();
+	for (auto& shard : this->shards)
+		shard.bytes = 0;
+}
+
+std::string DnsCache::makeKey(const DnsName& qname, uint16_t qtype, uint16_t qclass)
+{
+	// names are case-insensitive, and label lengths are never letters
+	size_t len = qname.length();
+	const char* wire = qname.data();
+	
+	std::string key(len + 4, '\0');
+	dns_lower_hash(wire, &key[0], len);
+	
+	key[len+0] = qtype >> 8;
+	key[len+1] = qtype & 0xff;
+	key[len+2] = qclass >> 8;
+	key[len+3] = qclass & 0xff;
+	return key;
+}
+
+DnsCache::shard_t& DnsCache::shardFor(const std::string& key)
+{
+	size_t hash = std::hash<std::string>()(key);
+	// the tables use the low bits, so pick shards with the high ones
+	return shards[(hash >> 16) % shards.size()];
+}
+
+int DnsCache::lookup(const DnsName& qname, uint16_t qtype, uint16_t qclass,
+					 char* buffer, int bufsize)
+{
+	std::string key = makeKey(qname, qtype, qclass);
+	shard_t& shard = shardFor(key);
+	int64_t now = now_seconds();
+	
+	std::lock_guard<std::mutex> guard(shard.lock);
+	
+	auto it = shard.table.find(key);
+	if (it == shard.table.end())
+	{
+		DnsMetrics::count(DNS_CACHE_MISSES);
+		return 0;
+	}
+	
+	entry_t& entry = *it->second;
+	if (now >= entry.expires)
+	{
+		shard.bytes -= entry.size;
+		shard.lru.erase(it->second);
+		shard.table.erase(it);
+		DnsMetrics::count(DNS_CACHE_MISSES);
+		return 0;
+	}
+	if ((int) entry.packet.size() > bufsize)
+	{
+		DnsMetrics::count(DNS_CACHE_MISSES);
+		return 0;
+	}
+	DnsMetrics::count(DNS_CACHE_HITS);
+	
+	// recently used goes to the front
+	shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+	
+	// hand it out with the time spent in the cache taken off every TTL
+	memcpy(buffer, entry.packet.data(), entry.packet.size());
+	uint32_t elapsed = now - entry.stored;
+	
+	for (uint16_t offset : entry.ttls)
+	{
+		uint32_t ttl;
+		memcpy(&ttl, buffer + offset, sizeof(ttl));
+		ttl = ntohl(ttl);
+		ttl = (ttl > elapsed) ? ttl - elapsed : 0;
+		ttl = htonl(ttl);
+		memcpy(buffer + offset, &ttl, sizeof(ttl));
+	}
+	return entry.packet.size();
+}
+
+void DnsCache::store(const DnsName& qname, uint16_t qtype, uint16_t qclass,
+					 const char* packet, int len)
+{
+	DnsView view;
+	if (!view.parse(packet, len) || view.overflowed()) return;
+	
+	const dns_header_t& dns = view.header();
+	if (dns.tc) return; // never keep a partial answer
+	
+	int64_t ttl = -1;
+	
+	if (dns.rcode == NO_ERROR && view.count(DNS_ANSWER) > 0)
+	{
+		// positive answer, valid as long as its shortest TTL
+		const dns_rr_view_t* rr = view.records(DNS_ANSWER);
+		for (int i = 0; i < view.count(DNS_ANSWER); i++)
+			if (ttl < 0 || rr[i].ttl < ttl) ttl = rr[i].ttl;
+		
+		if (ttl > DNS_CACHE_MAX_TTL) ttl = DNS_CACHE_MAX_TTL;
+	}
+	else if (dns.rcode == NO_ERROR || dns.rcode == NAME_ERROR)
+	{
+		// NODATA or NXDOMAIN, valid for the lesser of the SOA TTL
+		// and its MINIMUM field (RFC 2308 section 5)
+		const dns_rr_view_t* rr = view.records(DNS_AUTHORITY);
+		for (int i = 0; i < view.count(DNS_AUTHORITY); i++)
+		{
+			// MINIMUM is always the last 32 bits of the rdata
+			if (rr[i].type != DNS_TYPE_SOA || rr[i].rdlength < 22) continue;
+			
+			uint32_t minimum;
+			memcpy(&minimum, view.rdata(rr[i]) + rr[i].rdlength - 4, sizeof(minimum));
+			minimum = ntohl(minimum);
+			
+			ttl = (rr[i].ttl < minimum) ? rr[i].ttl : minimum;
+			break;
+		}
+		if (ttl > DNS_CACHE_MAX_NEGATIVE_TTL) ttl = DNS_CACHE_MAX_NEGATIVE_TTL;
+	}
+	// no SOA for a negative answer, or an error
+	if (ttl <= 0) return;
+	
+	entry_t entry;
+	entry.key     = makeKey(qname, qtype, qclass);
+	entry.packet  = std::string(packet, len);
+	entry.stored  = now_seconds();
+	entry.expires = entry.stored + ttl;
+	
+	// the TTL of a record sits right before its rdata length and rdata,
+	// except in OPT, where those bits are the extended RCODE and flags
+	for (int s = 0; s < 3; s++)
+	{
+		const dns_rr_view_t* rr = view.records((dns_section_t) s);
+		for (int i = 0; i < view.count((dns_section_t) s); i++)
+		{
+			if (rr[i].type == DNS_TYPE_OPT) continue;
+			entry.ttls.push_back(rr[i].rdata - 6);
+		}
+	}
+	entry.size = entry.key.size() * 2 + len
+			   + entry.ttls.size() * sizeof(uint16_t) + CACHE_ENTRY_OVERHEAD;
+	
+	shard_t& shard = shardFor(entry.key);
+	if (entry.size > shard_bytes) return;
+	
+	std::lock_guard<std::mutex> guard(shard.lock);
+	
+	// replace what was there
+	auto it = shard.table.find(entry.key);
+	if (it != shard.table.end())
+	{
+		shard.bytes -= it->second->size;
+		shard.lru.erase(it->second);
+		shard.table.erase(it);
+	}
+	
+	// make room by evicting the least recently used
+	while (shard.bytes + entry.size > shard_bytes)
+	{
+		entry_t& victim = shard.lru.back();
+		shard.bytes -= victim.size;
+		shard.table.erase(victim.key);
+		shard.lru.pop_back();
+	}
+	
+	shard.bytes += entry.size;
+	shard.lru.push_front(std::move(entry));
+	shard.table[shard.lru.front().key] = shard.lru.begin();
+}
+
+void DnsCache::clear()
+{
+	for (auto& shard : shards)
+	{
+		std::lock_guard<std::mutex> guard(shard.lock);
+		shard.table.clear();
+		shard.lru.clear();
+		shard.bytes = 0;
+	}
+}
+
+size_t DnsCache::bytes() const
+{
+	size_t total = 0;
+	for (auto& shard : shards)
+	{
+		std::lock_guard<std::mutex> guard(shard.lock);
+		total += shard.bytes;
+	}
+	return total;
+}
+
+size_t DnsCache::entries() const
+{
+	size_t total = 0;
+	for (auto& shard : shards)
+	{
+		std::lock_guard<std::mutex> guard(shard.lock);
+		total += shard.table.size();
+	}
+	return total;
+}
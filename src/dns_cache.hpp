@@ -0,0 +1,80 @@
+#ifndef DNS_CACHE_HPP
+#define DNS_CACHE_HPP
+
+#include "dns_name.hpp"
+
+#include <stdint.h>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// never keep anything longer than this, whatever the TTL says
+#define DNS_CACHE_MAX_TTL  86400
+// how long to remember a negative answer at most (RFC 2308 section 5)
+#define DNS_CACHE_MAX_NEGATIVE_TTL  10800
+
+/**
+ * Response cache for (qname, qtype, qclass)
+ * 
+ * Whole responses are kept as they came off the wire, and handed back
+ * with their TTLs counted down, so a hit looks exactly like a fresh
+ * answer to the parser. Positive answers live as long as their
+ * shortest TTL, NXDOMAIN and NODATA as long as the SOA in the
+ * authority section allows (RFC 2308), and responses without either
+ * are never cached.
+ * 
+ * The cache is split into shards with a lock and an LRU list each,
+ * so threads hitting different names don't contend, and the memory
+ * bound is divided evenly between them.
+**/
+class DnsCache
+{
+public:
+	DnsCache(size_t max_bytes = 64 << 20, unsigned shards = 16);
+	
+	// copy the cached response to the question into buffer, returns
+	// its length, or 0 if there is nothing (still) valid cached
+	int lookup(const DnsName& qname, uint16_t qtype, uint16_t qclass,
+			   char* buffer, int bufsize);
+	
+	// remember the response of len bytes to the question,
+	// if it is something that can be cached
+	void store(const DnsName& qname, uint16_t qtype, uint16_t qclass,
+			   const char* packet, int len);
+	
+	// drop everything
+	void clear();
+	
+	size_t bytes() const;
+	size_t entries() const;
+	
+private:
+	struct entry_t
+	{
+		std::string key;
+		std::string packet;
+		std::vector<uint16_t> ttls; // offsets of every TTL in packet
+		int64_t stored;  // seconds
+		int64_t expires; // seconds
+		size_t  size;    // what we charge for it
+	};
+	typedef std::list<entry_t> lru_t;
+	
+	struct shard_t
+	{
+		mutable std::mutex lock;
+		lru_t lru; // most recently used first
+		std::unordered_map<std::string, lru_t::iterator> table;
+		size_t bytes;
+	};
+	
+	static std::string makeKey(const DnsName& qname, uint16_t qtype, uint16_t qclass);
+	shard_t& shardFor(const std::string& key);
+	
+	std::vector<shard_t> shards;
+	size_t shard_bytes; // memory bound per shard
+};
+
+#endif
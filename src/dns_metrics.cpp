@@ -0,0 +1,210 @@
+#include "dns_metrics.hpp"
+#include "dns.hpp"
+
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+// how the counters and histograms are exported
+struct metric_info_t
+{
+	const char* name;
+	const char* help;
+};
+
+static const metric_info_t counter_info[DNS_COUNTERS] =
+{
+	{ "dns_upstream_queries_total",     "Queries sent to nameservers over UDP, retransmits included" },
+	{ "dns_upstream_retransmits_total", "Queries sent again, to the same or another nameserver" },
+	{ "dns_upstream_timeouts_total",    "Times a nameserver took longer to answer than it was given" },
+	{ "dns_upstream_truncated_total",   "Truncated answers, asked again over TCP" },
+	{ "dns_upstream_answers_total",     "Answers taken from nameservers" },
+	{ "dns_upstream_nxdomain_total",    "Answers from nameservers saying the name does not exist" },
+	{ "dns_cache_hits_total",           "Lookups answered from the cache" },
+	{ "dns_cache_misses_total",         "Lookups the cache had no answer for" },
+	{ "dns_server_queries_total",       "Queries received by the server" },
+	{ "dns_server_forwarded_total",     "Queries forwarded upstream" },
+	{ "dns_server_responses_total",     "Responses sent by the server" },
+	{ "dns_server_nxdomain_total",      "Responses saying the name does not exist" },
+	{ "dns_server_truncated_total",     "Responses truncated to fit in UDP" },
+	{ "dns_server_log_dropped_total",   "Query log records dropped, the log writer falling behind" },
+	{ "dns_server_rate_limited_total",  "Responses dropped by response rate limiting" },
+	{ "dns_server_slipped_total",       "Responses sent truncated by response rate limiting" },
+	{ "dns_server_shed_total",          "Queries dropped unanswered, having waited too long to be read" },
+};
+
+static const metric_info_t histogram_info[DNS_HISTOGRAMS] =
+{
+	{ "dns_upstream_rtt_seconds",         "Time from sending a query to a nameserver to reading its answer" },
+	{ "dns_server_processing_seconds",    "Time from reading a query to sending its response" },
+};
+
+// the exported buckets end at these powers of two nanoseconds, ~1us to ~34s
+#define EXPORT_FIRST_BITS  10
+#define EXPORT_LAST_BITS   35
+
+// every block ever handed out, and the ones no thread has now
+struct registry_t
+{
+	std::mutex lock;
+	std::vector<void*> all;
+	std::vector<void*> idle;
+};
+
+static registry_t& registry()
+{
+	// never destroyed, threads may still exit while the program does
+	static registry_t* reg = new registry_t;
+	return *reg;
+}
+
+// set once the thread's owner is gone, a block taken after
+// that (by another thread_local's destructor) is never given back
+static thread_local bool owner_gone = false;
+
+struct DnsMetrics::owner_t
+{
+	block_t* block = nullptr;
+	
+	~owner_t()
+	{
+		if (block == nullptr) return;
+		
+		registry_t& reg = registry();
+		std::lock_guard<std::mutex> guard(reg.lock);
+		reg.idle.push_back(block);
+		DnsMetrics::mine = nullptr;
+		owner_gone = true;
+	}
+};
+
+thread_local DnsMetrics::block_t* DnsMetrics::mine = nullptr;
+
+DnsMetrics::block_t& DnsMetrics::adopt()
+{
+	static thread_local owner_t owner;
+	
+	registry_t& reg = registry();
+	block_t* block;
+	{
+		std::lock_guard<std::mutex> guard(reg.lock);
+		if (!reg.idle.empty())
+		{
+			block = (block_t*) reg.idle.back();
+			reg.idle.pop_back();
+		}
+		else
+		{
+			// the heap doesn't align to more than 16 bytes on its own
+			void* memory = nullptr;
+			if (posix_memalign(&memory, alignof(block_t), sizeof(block_t)) != 0)
+				throw std::bad_alloc();
+			// value initialized, all zeros
+			block = new (memory) block_t();
+			reg.all.push_back(block);
+		}
+	}
+	if (!owner_gone) owner.block = block;
+	mine = block;
+	return *block;
+}
+
+void DnsMetrics::response(const char* packet)
+{
+	const dns_header_t& hdr = *(const dns_header_t*) packet;
+	
+	count(DNS_SERVER_RESPONSES);
+	if (hdr.rcode == NAME_ERROR) count(DNS_SERVER_NXDOMAIN);
+	if (hdr.tc) count(DNS_SERVER_TRUNCATED);
+}
+
+void DnsMetrics::collect(dns_metrics_t& totals)
+{
+	memset(&totals, 0, sizeof(totals));
+	
+	registry_t& reg = registry();
+	std::lock_guard<std::mutex> guard(reg.lock);
+	
+	for (void* memory : reg.all)
+	{
+		const block_t& block = *(const block_t*) memory;
+		
+		for (int c = 0; c < DNS_COUNTERS; c++)
+			totals.counters[c] += block.counters[c].load(std::memory_order_relaxed);
+		for (int h = 0; h < DNS_HISTOGRAMS; h++)
+		{
+			for (int b = 0; b < DNS_HISTOGRAM_BUCKETS; b++)
+				totals.buckets[h][b] += block.buckets[h][b].load(std::memory_order_relaxed);
+			totals.sum[h] += block.sum[h].load(std::memory_order_relaxed);
+		}
+	}
+}
+
+uint64_t dns_metrics_t::count(dns_histogram_t hist) const
+{
+	return below(hist, 64);
+}
+
+uint64_t dns_metrics_t::below(dns_histogram_t hist, int bits) const
+{
+	// the first bucket of 2^bits is where the ones below it end
+	int end = DNS_HISTOGRAM_BUCKETS;
+	if (bits < DNS_HISTOGRAM_SUB_BITS)
+		end = 1 << bits;
+	else if (bits < DNS_HISTOGRAM_MAX_BITS)
+		end = DnsMetrics::bucket(1ull << bits);
+	
+	uint64_t total = 0;
+	for (int b = 0; b < end; b++)
+		total += this->buckets[hist][b];
+	return total;
+}
+
+std::string DnsMetrics::prometheus()
+{
+	// a few kilobytes, not worth keeping on the stack
+	std::unique_ptr<dns_metrics_t> totals(new dns_metrics_t);
+	collect(*totals);
+	
+	std::string text;
+	char line[256];
+	
+	for (int c = 0; c < DNS_COUNTERS; c++)
+	{
+		const metric_info_t& info = counter_info[c];
+		snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s counter\n%s %llu\n",
+				 info.name, info.help, info.name, info.name,
+				 (unsigned long long) totals->counters[c]);
+		text += line;
+	}
+	for (int h = 0; h < DNS_HISTOGRAMS; h++)
+	{
+		const metric_info_t& info = histogram_info[h];
+		dns_histogram_t hist = (dns_histogram_t) h;
+		
+		snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s histogram\n",
+				 info.name, info.help, info.name);
+		text += line;
+		
+		// buckets end where those of a power of two begin, so
+		// these counts are exact rather than interpolated
+		for (int bits = EXPORT_FIRST_BITS; bits <= EXPORT_LAST_BITS; bits++)
+		{
+			snprintf(line, sizeof(line), "%s_bucket{le=\"%.10g\"} %llu\n", info.name,
+					 (double) (1ull << bits) / 1e9,
+					 (unsigned long long) totals->below(hist, bits));
+			text += line;
+		}
+		uint64_t count = totals->count(hist);
+		snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %.9f\n%s_count %llu\n",
+				 info.name, (unsigned long long) count,
+				 info.name, totals->sum[h] / 1e9,
+				 info.name, (unsigned long long) count);
+		text += line;
+	}
+	return text;
+}
@@ -0,0 +1,136 @@
+#ifndef DNS_METRICS_HPP
+#define DNS_METRICS_HPP
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+// histogram buckets per power of two, which bounds the error of a
+// value read back from one to an eighth
+#define DNS_HISTOGRAM_SUB_BITS  3
+#define DNS_HISTOGRAM_SUB       (1 << DNS_HISTOGRAM_SUB_BITS)
+// values (in nanoseconds) from 2^this on share the last bucket, ~68s
+#define DNS_HISTOGRAM_MAX_BITS  36
+#define DNS_HISTOGRAM_BUCKETS   ((DNS_HISTOGRAM_MAX_BITS - DNS_HISTOGRAM_SUB_BITS + 1) * DNS_HISTOGRAM_SUB)
+#define DNS_CACHE_LINE          64
+
+// what is counted
+enum dns_counter_t
+{
+	// the resolvers, and the nameservers they ask
+	DNS_UPSTREAM_QUERIES = 0, // sent over UDP, retransmits included
+	DNS_UPSTREAM_RETRANSMITS, // sent again, to the same or another nameserver
+	DNS_UPSTREAM_TIMEOUTS,    // a nameserver took longer than it was given
+	DNS_UPSTREAM_TRUNCATED,   // answers too big for UDP, asked again over TCP
+	DNS_UPSTREAM_ANSWERS,
+	DNS_UPSTREAM_NXDOMAIN,
+	DNS_CACHE_HITS,
+	DNS_CACHE_MISSES,
+	// the server, and the clients it answers
+	DNS_SERVER_QUERIES,
+	DNS_SERVER_FORWARDED,     // outside the zone, and not in the cache
+	DNS_SERVER_RESPONSES,
+	DNS_SERVER_NXDOMAIN,
+	DNS_SERVER_TRUNCATED,
+	DNS_SERVER_LOG_DROPPED,   // query log records, the log writer falling behind
+	DNS_SERVER_RATE_LIMITED,  // responses dropped by the rate limiter
+	DNS_SERVER_SLIPPED,       // responses the rate limiter sent truncated instead
+	DNS_SERVER_SHED,          // queries too old to answer by the time they were read
+	DNS_COUNTERS
+};
+
+// what is timed
+enum dns_histogram_t
+{
+	DNS_UPSTREAM_RTT = 0,     // query sent to answer read, per nameserver
+	DNS_SERVER_TIME,          // query read to response sent, per query
+	DNS_HISTOGRAMS
+};
+
+// everything every thread has recorded, added up
+struct dns_metrics_t
+{
+	uint64_t counters[DNS_COUNTERS];
+	uint64_t buckets[DNS_HISTOGRAMS][DNS_HISTOGRAM_BUCKETS];
+	uint64_t sum[DNS_HISTOGRAMS]; // nanoseconds
+	
+	// samples in a histogram
+	uint64_t count(dns_histogram_t hist) const;
+	// samples in a histogram less than 2^bits nanoseconds
+	uint64_t below(dns_histogram_t hist, int bits) const;
+};
+
+/**
+ * Counters and latency histograms, for the resolvers and the server
+ *
+ * Every thread records into a block of its own, cache line aligned so
+ * no other thread ever writes next to it, with plain loads and stores
+ * instead of locked instructions, so recording costs about as much as
+ * incrementing a local variable. The blocks are only read, and added
+ * up, when someone asks for the totals with collect(). A thread that
+ * exits leaves its block to the next thread that starts, so nothing
+ * it counted is lost and the number of blocks stays bounded.
+ *
+ * Histograms are log-linear, like HdrHistogram: each power of two is
+ * split into DNS_HISTOGRAM_SUB buckets, so any value from a nanosecond
+ * to a minute is kept to within an eighth in a few kilobytes.
+**/
+class DnsMetrics
+{
+public:
+	static void count(dns_counter_t counter, uint64_t n = 1)
+	{
+		std::atomic<uint64_t>& c = local().counters[counter];
+		c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+	// n samples of ns nanoseconds each
+	static void record(dns_histogram_t hist, uint64_t ns, uint64_t n = 1)
+	{
+		block_t& block = local();
+		std::atomic<uint64_t>& b = block.buckets[hist][bucket(ns)];
+		std::atomic<uint64_t>& s = block.sum[hist];
+		b.store(b.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+		s.store(s.load(std::memory_order_relaxed) + ns * n, std::memory_order_relaxed);
+	}
+	// count the response in packet on its way to a client
+	static void response(const char* packet);
+	
+	// the totals so far, from every thread
+	static void collect(dns_metrics_t& totals);
+	// the totals in the Prometheus text exposition format
+	static std::string prometheus();
+	
+	static int bucket(uint64_t ns)
+	{
+		if (ns < DNS_HISTOGRAM_SUB) return ns;
+		
+		int bits = 63 - __builtin_clzll(ns);
+		if (bits >= DNS_HISTOGRAM_MAX_BITS) return DNS_HISTOGRAM_BUCKETS - 1;
+		
+		int sub = (ns >> (bits - DNS_HISTOGRAM_SUB_BITS)) & (DNS_HISTOGRAM_SUB - 1);
+		return (bits - DNS_HISTOGRAM_SUB_BITS + 1) * DNS_HISTOGRAM_SUB + sub;
+	}
+
+private:
+	// written by one thread at a time, read by anyone
+	struct alignas(DNS_CACHE_LINE) block_t
+	{
+		std::atomic<uint64_t> counters[DNS_COUNTERS];
+		std::atomic<uint64_t> buckets[DNS_HISTOGRAMS][DNS_HISTOGRAM_BUCKETS];
+		std::atomic<uint64_t> sum[DNS_HISTOGRAMS];
+	};
+	
+	static block_t& local()
+	{
+		block_t* block = mine;
+		return block ? *block : adopt();
+	}
+	// the block for a thread that has none yet
+	static block_t& adopt();
+	
+	// gives the block back when the thread exits
+	struct owner_t;
+	static thread_local block_t* mine;
+};
+
+#endif
@@ -0,0 +1,235 @@
+#include "dns_name.hpp"
+#include "dns_simd.hpp"
+
+#include <ctype.h>
+#include <string.h>
+
+int DnsName::read(const char* packet, int plen, int offset)
+{
+	const unsigned char* p = (const unsigned char*) packet;
+	int end   = -1;     // where the name ends in the packet
+	int limit = offset; // pointers must go back further than this
+	int pos   = offset;
+	int n     = 0;
+	
+	while (pos >= 0 && pos < plen)
+	{
+		unsigned label = p[pos];
+		
+		if (label >= 192)
+		{
+			if (pos + 1 >= plen) return -1;
+			int target = (label & 0x3f) << 8 | p[pos + 1];
+			
+			// only the first pointer moves us forward in the packet
+			if (end < 0) end = pos + 2;
+			// strictly backwards every time, so we can't loop
+			if (target >= limit) return -1;
+			
+			limit = pos = target;
+			continue;
+		}
+		// extended label types aren't supported, and the
+		// label has to fit in both the packet and the name
+		if (label >= 64 || (int) label >= plen - pos ||
+			n + (int) label + 1 > DNS_WIRE_NAME_MAX)
+			return -1;
+		
+		wire[n++] = label;
+		if (label == 0)
+		{
+			this->len = n;
+			return (end < 0) ? pos + 1 : end;
+		}
+		memcpy(wire + n, p + pos + 1, label);
+		n   += label;
+		pos += label + 1;
+	}
+	return -1; // ran off the end of the packet
+}
+
+bool DnsName::parse(const char* name)
+{
+	int textlen = strlen(name);
+	int p = 0;
+	
+	if (textlen == 0) return false;
+	// one trailing dot is fine, and a lone one is the root, but
+	// only one: any more would end the name in an empty label
+	if (name[textlen - 1] == '.') textlen--;
+	if (textlen > 0 && name[textlen - 1] == '.') return false;
+	// a length before the first label and the root label after the last
+	if (textlen + 2 > DNS_WIRE_NAME_MAX) return false;
+	if (!dns_visible(name, textlen)) return false;
+	
+	const char* end = name + textlen;
+	while (name < end)
+	{
+		const char* dot = (const char*) memchr(name, '.', end - name);
+		if (dot == nullptr) dot = end;
+		
+		int labelen = dot - name;
+		if (labelen == 0 || labelen > 63) return false;
+		wire[p] = labelen;
+		memcpy(wire + p + 1, name, labelen);
+		p += labelen + 1;
+		
+		name = (dot < end) ? dot + 1 : end;
+	}
+	wire[p++] = '\0';
+	this->len = p;
+	return true;
+}
+
+int DnsName::toText(char* out, int outlen) const
+{
+	int p   = 0;
+	int pos = 0;
+	
+	while (pos < len && wire[pos])
+	{
+		int label = (unsigned char) wire[pos];
+		// room for the label, a dot and the terminating zero
+		if (p + label + 2 > outlen) return -1;
+		
+		if (p) out[p++] = '.';
+		memcpy(out + p, wire + pos + 1, label);
+		p   += label;
+		pos += label + 1;
+	}
+	if (outlen < 1) return -1;
+	out[p] = '\0';
+	return p;
+}
+
+bool DnsName::printable() const
+{
+	int pos = 0;
+	while (pos < len && wire[pos])
+	{
+		int label = (unsigned char) wire[pos];
+		if (!dns_visible(wire + pos + 1, label) || memchr(wire + pos + 1, '.', label))
+			return false;
+		pos += label + 1;
+	}
+	return true;
+}
+
+int DnsName::hashWire(const char* name, const char* end, uint32_t& hash, char* lower)
+{
+	const unsigned char* p    = (const unsigned char*) name;
+	const unsigned char* uend = (const unsigned char*) end;
+	
+	// only the lengths, to find where it ends, the bytes
+	// in between are folded and hashed all at once after
+	while (p < uend)
+	{
+		unsigned labelen = *p;
+		
+		if (labelen == 0)
+		{
+			int n = p + 1 - (const unsigned char*) name;
+			hash = dns_lower_hash(name, lower, n);
+			return n;
+		}
+		// compression (and extended labels) have no business here
+		if (labelen >= 64 || (int) labelen >= uend - p) return 0;
+		p += labelen + 1;
+		
+		// names are never longer than 255 bytes
+		if (p - (const unsigned char*) name >= DNS_WIRE_NAME_MAX) return 0;
+	}
+	return 0;
+}
+
+bool DnsName::equalWire(const char* a, const char* b, int len)
+{
+	// label lengths are never letters, so they can be folded too
+	for (int i = 0; i < len; i++)
+	{
+		if (a[i] != b[i] &&
+			tolower((unsigned char) a[i]) != tolower((unsigned char) b[i]))
+			return false;
+	}
+	return true;
+}
+
+int DnsNameEncoder::write(int pos, const DnsName& name, int maxlen)
+{
+	const char* wire = name.data();
+	int at     = 0;  // where in the name the suffix starts
+	int target = -1; // where it is in the message
+	
+	// the longest suffix of the name already in the message
+	while (wire[at] && target < 0)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			if (matches(suffixes[i], wire + at))
+			{
+				target = suffixes[i];
+				break;
+			}
+		}
+		if (target < 0) at += (unsigned char) wire[at] + 1;
+	}
+	
+	int need = at + ((target >= 0) ? 2 : 1);
+	if (need > maxlen || pos + need > size) return -1;
+	
+	memcpy(packet + pos, wire, at);
+	if (target >= 0)
+	{
+		packet[pos + at]     = 0xc0 | target >> 8;
+		packet[pos + at + 1] = target & 0xff;
+	}
+	else packet[pos + at] = '\0';
+	
+	// every label written can be pointed at from now on
+	for (int p = 0; p < at; p += (unsigned char) wire[p] + 1)
+		add(pos + p);
+	return need;
+}
+
+void DnsNameEncoder::remember(int pos)
+{
+	const unsigned char* p = (const unsigned char*) packet;
+	
+	// only the labels themselves, up to the end or the first pointer
+	while (pos < size && p[pos] && p[pos] < 64)
+	{
+		add(pos);
+		pos += p[pos] + 1;
+	}
+}
+
+void DnsNameEncoder::add(int offset)
+{
+	// pointers only reach the first 16k of a message
+	if (count < DNS_COMPRESS_MAX && offset < 0x4000)
+		suffixes[count++] = offset;
+}
+
+bool DnsNameEncoder::matches(int offset, const char* wire) const
+{
+	const unsigned char* p = (const unsigned char*) packet;
+	const unsigned char* w = (const unsigned char*) wire;
+	
+	// everything in the table was written (or checked) by us,
+	// and its pointers go backwards, so this always ends
+	while (true)
+	{
+		if (p[offset] >= 192)
+		{
+			offset = (p[offset] & 0x3f) << 8 | p[offset + 1];
+			continue;
+		}
+		if (p[offset] != *w) return false;
+		if (*w == 0) return true;
+		
+		if (!DnsName::equalWire(packet + offset + 1, (const char*) w + 1, *w))
+			return false;
+		offset += *w + 1;
+		w      += *w + 1;
+	}
+}
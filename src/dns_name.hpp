@@ -0,0 +1,113 @@
+#ifndef DNS_NAME_HPP
+#define DNS_NAME_HPP
+
+#include <stdint.h>
+
+// longest name in wire format, with the root label (RFC 1035)
+#define DNS_WIRE_NAME_MAX  255
+// names a DnsNameEncoder remembers for compression, per message
+#define DNS_COMPRESS_MAX    32
+
+/**
+ * A name in wire format (3www6google3com0)
+ *
+ * Kept uncompressed in a buffer of its own, so a name can be read out
+ * of a packet, hashed, compared and written into another one without
+ * ever allocating or being turned into a dotted string. Names compare
+ * and hash the same whatever their case (RFC 4343), but keep the case
+ * they came with.
+**/
+class DnsName
+{
+public:
+	DnsName() : len(0) {}
+	
+	// read the name at offset in a packet of plen bytes, following
+	// compression pointers, returns the offset just past where it
+	// lies in the packet, or -1 if it is malformed
+	int  read(const char* packet, int plen, int offset);
+	// from www.google.com (a trailing dot is fine, and . is the root),
+	// returns false if it is not a valid name, or has anything but
+	// visible ASCII in it
+	bool parse(const char* dotted);
+	// write the name as www.google.com into out, returns its length,
+	// or -1 if it doesn't fit in outlen bytes with the terminating zero;
+	// labels are copied as they are, nothing is escaped
+	int  toText(char* out, int outlen) const;
+	// true if toText() spells the name so that parse() reads back the
+	// same one: no label has a dot, or anything but visible ASCII, in it
+	bool printable() const;
+	
+	const char* data() const
+	{
+		return this->wire;
+	}
+	// bytes in wire format, 0 for no name at all
+	int length() const
+	{
+		return this->len;
+	}
+	uint32_t hash() const
+	{
+		uint32_t h = 0;
+		hashWire(wire, wire + len, h);
+		return h;
+	}
+	
+	bool operator== (const DnsName& other) const
+	{
+		return len == other.len && equalWire(wire, other.wire, len);
+	}
+	bool operator!= (const DnsName& other) const
+	{
+		return !(*this == other);
+	}
+	
+	// check the uncompressed name at name, no further than end, and
+	// hash it (folded to lowercase, see dns_lower_hash), returns its
+	// length with the root label, or 0 if it is not a valid name;
+	// the lowercase name goes to lower too, unless it is nullptr
+	static int  hashWire(const char* name, const char* end, uint32_t& hash,
+						 char* lower = nullptr);
+	// true if the names of len bytes at a and b are the same, whatever their case
+	static bool equalWire(const char* a, const char* b, int len);
+
+private:
+	char    wire[DNS_WIRE_NAME_MAX];
+	uint8_t len;
+};
+
+/**
+ * Writes names into a message, compressed (RFC 1035 section 4.1.4)
+ *
+ * Every label written, and every name said to be in the message already,
+ * goes into a small table of suffixes, and each name written after them
+ * ends in a pointer to the longest of its suffixes found there. The
+ * table is a few offsets into the message, compared against it where
+ * they point, so nothing is allocated or hashed for it.
+**/
+class DnsNameEncoder
+{
+public:
+	DnsNameEncoder(char* packet, int size)
+		: packet(packet), size(size), count(0) {}
+	
+	// write name at pos, in no more than maxlen bytes, returns the
+	// bytes written or -1 if it didn't fit
+	int  write(int pos, const DnsName& name, int maxlen);
+	// the uncompressed name at pos (say, the question) is in the
+	// message already, let names written later point into it
+	void remember(int pos);
+
+private:
+	// true if the name at offset in the message is the same as wire
+	bool matches(int offset, const char* wire) const;
+	void add(int offset);
+	
+	char* packet;
+	int   size;
+	int   count;
+	uint16_t suffixes[DNS_COMPRESS_MAX];
+};
+
+#endif
@@ -0,0 +1,165 @@
+#include "dns_nameservers.hpp"
+#include "dns_metrics.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <string.h>
+
+static uint64_t key(const sockaddr_in& addr)
+{
+	return (uint64_t) addr.sin_addr.s_addr << 16 | addr.sin_port;
+}
+
+uint64_t DnsNameservers::now_us()
+{
+	using namespace std::chrono;
+	return duration_cast<microseconds>(
+			steady_clock::now().time_since_epoch()).count();
+}
+
+int DnsNameservers::add(const sockaddr_in& addr)
+{
+	int server = find(addr);
+	if (server >= 0) return server;
+	
+	server_t s;
+	memset(&s, 0, sizeof(s));
+	s.addr = addr;
+	servers.push_back(s);
+	
+	server = servers.size() - 1;
+	index[key(addr)] = server;
+	return server;
+}
+
+void DnsNameservers::clear()
+{
+	servers.clear();
+	index.clear();
+	allowed.clear();
+}
+
+int DnsNameservers::find(const sockaddr_in& addr) const
+{
+	auto it = index.find(key(addr));
+	return (it != index.end()) ? it->second : -1;
+}
+
+int DnsNameservers::pick(int except)
+{
+	uint64_t now = now_us();
+	int best    = -1;
+	int waiting = -1; // in hold down, and back the soonest
+	
+	int count = allowed.empty() ? size() : allowed.size();
+	
+	for (int n = 0; n < count; n++)
+	{
+		int i = allowed.empty() ? n : allowed[n];
+		if (i == except) continue;
+		server_t& s = servers[i];
+		decay(s, now);
+		
+		if (s.failures >= DNS_NS_MAX_FAILURES && now < s.holddown)
+		{
+			if (waiting < 0 || s.holddown < servers[waiting].holddown)
+				waiting = i;
+			continue;
+		}
+		// one that hasn't been measured yet goes first, and
+		// one that has been timing out looks that much slower
+		if (best < 0 || cost(s) < cost(servers[best]))
+			best = i;
+	}
+	if (best < 0)
+		best = (waiting >= 0) ? waiting : except;
+	return best;
+}
+
+void DnsNameservers::decay(server_t& s, uint64_t now)
+{
+	if (s.srtt == 0) return;
+	
+	uint64_t halvings = (now - s.decayed) / (DNS_NS_DECAY_MS * 1000);
+	if (halvings == 0) return;
+	
+	// never all the way to 0, which is for one never measured
+	s.srtt = std::max<int64_t>(1, (halvings < 63) ? s.srtt >> halvings : 0);
+	s.decayed += halvings * DNS_NS_DECAY_MS * 1000;
+}
+
+int64_t DnsNameservers::cost(const server_t& s)
+{
+	return s.srtt << std::min(s.failures, DNS_NS_MAX_FAILURES);
+}
+
+int DnsNameservers::timeout(int server) const
+{
+	const server_t& s = servers[server];
+	int64_t rto = initial_ms;
+	
+	if (s.srtt)
+		rto = (s.srtt + 4 * s.rttvar) / 1000;
+	// back off from one that keeps timing out
+	rto <<= std::min(s.failures, DNS_NS_MAX_FAILURES);
+	
+	return std::max<int64_t>(DNS_NS_MIN_TIMEOUT_MS,
+		   std::min<int64_t>(rto, DNS_NS_MAX_TIMEOUT_MS));
+}
+
+void DnsNameservers::sent(dns_attempt_t& attempt, int server)
+{
+	DnsMetrics::count(DNS_UPSTREAM_QUERIES);
+	if (attempt.server >= 0) DnsMetrics::count(DNS_UPSTREAM_RETRANSMITS);
+	
+	attempt.resent  = (attempt.server == server);
+	attempt.server  = server;
+	attempt.sent_us = now_us();
+}
+
+void DnsNameservers::answered(const dns_attempt_t& attempt, int server)
+{
+	server_t& s = servers[server];
+	s.failures = 0;
+	s.holddown = 0;
+	
+	// no telling which of the queries sent there this answers
+	if (attempt.server != server || attempt.resent) return;
+	
+	uint64_t now = now_us();
+	int64_t  rtt = std::max<int64_t>(1, now - attempt.sent_us);
+	DnsMetrics::record(DNS_UPSTREAM_RTT, rtt * 1000);
+	
+	if (s.srtt == 0)
+	{
+		s.srtt   = rtt;
+		s.rttvar = rtt / 2;
+	}
+	else
+	{
+		int64_t delta = (rtt > s.srtt) ? rtt - s.srtt : s.srtt - rtt;
+		s.rttvar += (delta - s.rttvar) / 4;
+		s.srtt   += (rtt - s.srtt) / 8;
+	}
+	s.decayed = now;
+}
+
+void DnsNameservers::failed(int server)
+{
+	server_t& s = servers[server];
+	DnsMetrics::count(DNS_UPSTREAM_TIMEOUTS);
+	
+	// one that has never answered is at least as slow as the time it missed
+	if (s.srtt == 0)
+	{
+		s.srtt    = timeout(server) * 1000;
+		s.decayed = now_us();
+	}
+	s.failures++;
+	
+	if (s.failures >= DNS_NS_MAX_FAILURES)
+	{
+		int backoff = std::min(s.failures - DNS_NS_MAX_FAILURES, 5);
+		s.holddown = now_us() + ((uint64_t) DNS_NS_HOLDDOWN_MS * 1000 << backoff);
+	}
+}
@@ -0,0 +1,112 @@
+#ifndef DNS_NAMESERVERS_HPP
+#define DNS_NAMESERVERS_HPP
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+// bounds on how long to wait for a nameserver before asking another
+#define DNS_NS_MIN_TIMEOUT_MS    20
+#define DNS_NS_MAX_TIMEOUT_MS  2000
+// timeouts in a row before a nameserver is left alone for a while
+#define DNS_NS_MAX_FAILURES       3
+// how long it is left alone, doubling with each further timeout
+#define DNS_NS_HOLDDOWN_MS     1000
+// a round-trip time halves for every this long without a new sample
+#define DNS_NS_DECAY_MS        1000
+
+// where and when a query was last sent
+struct dns_attempt_t
+{
+	int      server;  // -1 before it is sent
+	bool     resent;  // sent to that server more than once
+	uint64_t sent_us;
+};
+
+/**
+ * Upstream nameservers, and how well they have been answering
+ *
+ * Every nameserver keeps a smoothed round-trip time and its variance
+ * (as TCP does, RFC 6298), which gives both the order to ask them in
+ * and how long to wait before asking the next one as well. Nameservers
+ * that keep timing out are passed over, and probed again after a hold
+ * down that grows while they stay silent. A round-trip time halves for
+ * every DNS_NS_DECAY_MS it goes without a new sample, so one that was
+ * slow once gets measured again now and then, as often however many
+ * queries there are.
+ *
+ * Not thread-safe.
+**/
+class DnsNameservers
+{
+public:
+	DnsNameservers() : initial_ms(250) {}
+	
+	// add a nameserver, returns its index
+	int  add(const sockaddr_in& addr);
+	void clear();
+	
+	int size() const
+	{
+		return this->servers.size();
+	}
+	const sockaddr_in& address(int server) const
+	{
+		return this->servers[server].addr;
+	}
+	// the index of the nameserver at addr, or -1
+	int find(const sockaddr_in& addr) const;
+	// pick only among these nameservers from now on, or
+	// among all of them again if the list is empty
+	void restrict(const std::vector<int>& servers)
+	{
+		this->allowed = servers;
+	}
+	
+	// the fastest healthy nameserver other than except, or the one back
+	// from hold down the soonest, or except itself if it is the only
+	// one, -1 if there are none
+	int  pick(int except = -1);
+	// how long to wait for an answer from server before asking another
+	int  timeout(int server) const;
+	// how long to wait for a nameserver that hasn't answered yet
+	void set_initial_timeout(int timeout_ms)
+	{
+		this->initial_ms = timeout_ms;
+	}
+	
+	// a query is being sent to server
+	void sent(dns_attempt_t& attempt, int server);
+	// server answered the query, which counts as a round-trip
+	// sample unless the query was also sent there before (Karn)
+	void answered(const dns_attempt_t& attempt, int server);
+	// server didn't answer in time
+	void failed(int server);
+	
+	static uint64_t now_us();
+
+private:
+	struct server_t
+	{
+		sockaddr_in addr;
+		int64_t  srtt;     // us, 0 until the first sample
+		int64_t  rttvar;   // us
+		uint64_t decayed;  // us, when srtt was last sampled or halved
+		int      failures; // timeouts in a row
+		uint64_t holddown; // us, passed over until then
+	};
+	
+	// what picking s is expected to cost, in us
+	static int64_t cost(const server_t& s);
+	// halve the round-trip time of s for the time it has gone unsampled
+	static void decay(server_t& s, uint64_t now);
+	
+	std::vector<server_t> servers;
+	// index of each nameserver by address and port
+	std::unordered_map<uint64_t, int> index;
+	std::vector<int> allowed;
+	int initial_ms;
+};
+
+#endif
@@ -2,27 +2,63 @@
 #define DNS_REQUEST_HPP
 
 #include "dns.hpp"
+#include "dns_cache.hpp"
+#include "dns_metrics.hpp"
 
 class AbstractRequest
 {
 public:
 	AbstractRequest()
+		: buffer(DNS_BUFFER_SMALL), cache(nullptr), received(0),
+		  edns(DNS_EDNS_PAYLOAD), flags(DNS_FLAG_RD) {}
+	virtual ~AbstractRequest() {}
+	
+	// a request has sockets and buffers of its own
+	AbstractRequest(const AbstractRequest&) = delete;
+	AbstractRequest& operator=(const AbstractRequest&) = delete;
+	
+	// create/open connection to remote part
+	virtual void set_ns(const std::string& nameserver) = 0;
+	
+	// answer from (and remember answers in) cache, which may be
+	// shared between many requests, or nullptr to always ask
+	void set_cache(DnsCache* cache)
+	{
+		this->cache = cache;
+	}
+	
+	// UDP payload size to advertise with EDNS(0), or 0 to leave it out
+	void set_edns(unsigned short payload)
 	{
-		this->buffer = new char[65536];
+		this->edns = payload;
+		// UDP responses are no bigger than what we advertise
+		buffer.reserve(payload);
 	}
-	~AbstractRequest()
+	// whether to ask nameservers to recurse for us (RD)
+	void set_recursion(bool recurse)
 	{
-		delete[] this->buffer;
+		this->flags = recurse ? DNS_FLAG_RD : 0;
 	}
 	
-	// create/open connection to remote part
-	virtual void set_ns(const std::string& nameserver) = 0;
+	// the response the last answer was parsed from, as it came off the
+	// wire or out of the cache, valid until the next request
+	const char* getResponse(int& len) const
+	{
+		len = this->received;
+		return buffer.data();
+	}
 	
 	// send request and read response using send() and read()
-	bool request(const std::string& hostname)
+	bool request(const std::string& hostname, unsigned short qtype = DNS_TYPE_A)
 	{
 		// create request to nameserver
-		int messageSize = req.createRequest(buffer, hostname);
+		int messageSize = req.createRequest(query, hostname, qtype,
+											DNS_CLASS_INET, flags, edns);
+		if (messageSize == 0)
+			return false;
+		
+		if (cachedResponse(req))
+			return true;
 		
 		// send request (Linux)
 		if (!send(hostname, messageSize))
@@ -32,22 +68,72 @@ public:
 		if (!read())
 			return false;
 		
+		// the answer didn't fit, ask again where it does
+		if (received >= (int) sizeof(dns_header_t) &&
+			((dns_header_t*) buffer.data())->tc)
+		{
+			DnsMetrics::count(DNS_UPSTREAM_TRUNCATED);
+			if (!readTCP(messageSize))
+				return false;
+		}
+		
 		// parse response from nameserver
-		req.parseResponse(buffer);
+		if (!req.parseResponse(buffer.data(), received))
+			return false;
+		countAnswer(req);
+		
+		if (cache)
+			cache->store(req.getName(), req.getType(), req.getClass(), buffer.data(), received);
 		return true;
 	}
 	void print()
 	{
 		// print all the (currently) stored information
-		req.print(buffer);
+		req.print();
 	}
 	
 protected:
 	virtual bool send(const std::string& hostname, int messageSize) = 0;
 	virtual bool read() = 0;
+	// send the query again over TCP and read the full response,
+	// transports without TCP make do with the truncated one
+	virtual bool readTCP(int messageSize)
+	{
+		(void) messageSize;
+		return true;
+	}
+	
+	// parse a cached response to req into buffer, if there is one
+	bool cachedResponse(DnsRequest& req)
+	{
+		if (cache == nullptr) return false;
+		
+		int len = cache->lookup(req.getName(), req.getType(), req.getClass(),
+								buffer.data(), buffer.capacity());
+		if (len == 0) return false;
+		
+		// make it the answer to this particular request
+		((dns_header_t*) buffer.data())->id = req.getID();
+		this->received = len;
+		return req.parseResponse(buffer.data(), len);
+	}
+	// count an answer req was just parsed from, off the network
+	static void countAnswer(const DnsRequest& req)
+	{
+		DnsMetrics::count(DNS_UPSTREAM_ANSWERS);
+		if (req.getHeader().rcode == NAME_ERROR)
+			DnsMetrics::count(DNS_UPSTREAM_NXDOMAIN);
+	}
 	
 	DnsRequest req;
-	char*      buffer;
+	// responses are read into this, which only grows beyond
+	// the small size when one arrives over TCP
+	DnsBuffer  buffer;
+	DnsCache*  cache;
+	char       query[DNS_REQUEST_MAX]; // the request being sent
+	int        received; // bytes in buffer from the last read()
+	unsigned short edns;
+	unsigned short flags;
 };
 
 #endif
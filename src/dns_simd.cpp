@@ -0,0 +1,214 @@
+#include "dns_simd.hpp"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DNS_SIMD_X86
+#endif
+
+// the hash goes 8 bytes at a time (the last ones padded with zeros),
+// each word mixed into the state with a multiply and a shift
+#define HASH_SEED  0x9e3779b97f4a7c15ull
+#define HASH_MUL   0xff51afd7ed558ccdull
+
+static inline uint64_t mix(uint64_t h, uint64_t word)
+{
+	h = (h ^ word) * HASH_MUL;
+	return h ^ (h >> 29);
+}
+static inline uint32_t finish(uint64_t h, int len)
+{
+	h = (h ^ len) * HASH_MUL;
+	return h ^ (h >> 32);
+}
+
+static uint32_t lower_hash_scalar(const char* in, char* out, int len)
+{
+	uint64_t h = HASH_SEED;
+	
+	for (int i = 0; i < len; i += 8)
+	{
+		int n = (len - i < 8) ? len - i : 8;
+		char block[8] = { 0 };
+		
+		for (int j = 0; j < n; j++)
+		{
+			char c = in[i + j];
+			block[j] = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+		}
+		if (out) memcpy(out + i, block, n);
+		
+		uint64_t word;
+		memcpy(&word, block, sizeof(word));
+		h = mix(h, word);
+	}
+	return finish(h, len);
+}
+
+static bool visible_scalar(const char* text, int len)
+{
+	for (int i = 0; i < len; i++)
+	{
+		if (text[i] <= ' ' || text[i] >= 0x7f) return false;
+	}
+	return true;
+}
+
+#ifdef DNS_SIMD_X86
+
+// bytes are compared as signed, so everything from 0x80 up
+// is negative, which is never a letter nor visible ASCII
+
+__attribute__((target("sse2")))
+static inline __m128i lower_sse2(__m128i v)
+{
+	const __m128i before = _mm_set1_epi8('A' - 1);
+	const __m128i after  = _mm_set1_epi8('Z' + 1);
+	const __m128i bit    = _mm_set1_epi8('a' - 'A');
+	
+	__m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, before), _mm_cmplt_epi8(v, after));
+	return _mm_or_si128(v, _mm_and_si128(upper, bit));
+}
+
+__attribute__((target("sse2")))
+static uint32_t lower_hash_sse2(const char* in, char* out, int len)
+{
+	uint64_t h = HASH_SEED;
+	
+	for (int i = 0; i < len; i += 16)
+	{
+		int n = len - i;
+		__m128i v;
+		char tail[16];
+		
+		// never read past the end, the name may end a page
+		if (n >= 16)
+			v = _mm_loadu_si128((const __m128i*) (in + i));
+		else
+		{
+			memset(tail, 0, sizeof(tail));
+			memcpy(tail, in + i, n);
+			v = _mm_loadu_si128((const __m128i*) tail);
+		}
+		v = lower_sse2(v);
+		
+		uint64_t words[2];
+		_mm_storeu_si128((__m128i*) words, v);
+		if (out) memcpy(out + i, words, (n < 16) ? n : 16);
+		
+		h = mix(h, words[0]);
+		if (n > 8) h = mix(h, words[1]);
+	}
+	return finish(h, len);
+}
+
+__attribute__((target("sse2")))
+static bool visible_sse2(const char* text, int len)
+{
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i del   = _mm_set1_epi8(0x7f);
+	int i = 0;
+	
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i v  = _mm_loadu_si128((const __m128i*) (text + i));
+		__m128i ok = _mm_and_si128(_mm_cmpgt_epi8(v, space), _mm_cmplt_epi8(v, del));
+		if (_mm_movemask_epi8(ok) != 0xffff) return false;
+	}
+	return visible_scalar(text + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static uint32_t lower_hash_avx2(const char* in, char* out, int len)
+{
+	const __m256i before = _mm256_set1_epi8('A' - 1);
+	const __m256i after  = _mm256_set1_epi8('Z' + 1);
+	const __m256i bit    = _mm256_set1_epi8('a' - 'A');
+	uint64_t h = HASH_SEED;
+	
+	for (int i = 0; i < len; i += 32)
+	{
+		int n = len - i;
+		__m256i v;
+		char tail[32];
+		
+		if (n >= 32)
+			v = _mm256_loadu_si256((const __m256i*) (in + i));
+		else
+		{
+			memset(tail, 0, sizeof(tail));
+			memcpy(tail, in + i, n);
+			v = _mm256_loadu_si256((const __m256i*) tail);
+		}
+		__m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, before),
+										 _mm256_cmpgt_epi8(after, v));
+		v = _mm256_or_si256(v, _mm256_and_si256(upper, bit));
+		
+		uint64_t words[4];
+		_mm256_storeu_si256((__m256i*) words, v);
+		if (out) memcpy(out + i, words, (n < 32) ? n : 32);
+		
+		// as many words as the scalar version would take
+		for (int w = 0; w < 4 && w * 8 < n; w++)
+			h = mix(h, words[w]);
+	}
+	return finish(h, len);
+}
+
+__attribute__((target("avx2")))
+static bool visible_avx2(const char* text, int len)
+{
+	const __m256i space = _mm256_set1_epi8(' ');
+	const __m256i del   = _mm256_set1_epi8(0x7f);
+	int i = 0;
+	
+	for (; i + 32 <= len; i += 32)
+	{
+		__m256i v  = _mm256_loadu_si256((const __m256i*) (text + i));
+		__m256i ok = _mm256_and_si256(_mm256_cmpgt_epi8(v, space), _mm256_cmpgt_epi8(del, v));
+		if (_mm256_movemask_epi8(ok) != -1) return false;
+	}
+	return visible_sse2(text + i, len - i);
+}
+
+#endif
+
+struct kernels_t
+{
+	uint32_t (*lower_hash)(const char*, char*, int);
+	bool     (*visible)(const char*, int);
+	const char* name;
+};
+
+static kernels_t pick()
+{
+#if defined(DNS_SIMD_X86) && defined(__GNUC__) && defined(__linux__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return { lower_hash_avx2, visible_avx2, "avx2" };
+	if (__builtin_cpu_supports("sse2"))
+		return { lower_hash_sse2, visible_sse2, "sse2" };
+#elif defined(DNS_SIMD_X86) && defined(__SSE2__)
+	// no telling what the CPU has, so what we were built for will do
+	return { lower_hash_sse2, visible_sse2, "sse2" };
+#endif
+	return { lower_hash_scalar, visible_scalar, "scalar" };
+}
+
+static const kernels_t kernels = pick();
+
+uint32_t dns_lower_hash(const char* in, char* out, int len)
+{
+	return kernels.lower_hash(in, out, len);
+}
+
+bool dns_visible(const char* text, int len)
+{
+	return kernels.visible(text, len);
+}
+
+const char* dns_simd_kernels()
+{
+	return kernels.name;
+}
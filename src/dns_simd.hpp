@@ -0,0 +1,28 @@
+#ifndef DNS_SIMD_HPP
+#define DNS_SIMD_HPP
+
+#include <stdint.h>
+
+/**
+ * Per-byte work on names, vectorised where the CPU allows it
+ *
+ * The kernels are picked once, at startup, by what the CPU running us
+ * supports (AVX2, then SSE2, then plain C), so the same binary runs
+ * everywhere and is fast where it can be. Every version gives exactly
+ * the same results, hashes included, since zone images store them.
+**/
+
+// lowercase the len bytes at in (ASCII only, other bytes are left as
+// they are) into out, unless it is nullptr, and hash them, in one pass,
+// out may be in; label lengths are never letters, so a whole name in
+// wire format can go through at once
+uint32_t dns_lower_hash(const char* in, char* out, int len);
+
+// true if all len characters at text are visible ASCII, which is
+// what a name given as text may be made of (no spaces, no controls)
+bool dns_visible(const char* text, int len);
+
+// which kernels were picked: "avx2", "sse2" or "scalar"
+const char* dns_simd_kernels();
+
+#endif
@@ -0,0 +1,302 @@
+#include "dns_tcp.hpp"
+#include "dns.hpp"
+
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static uint64_t now_ms()
+{
+	using namespace std::chrono;
+	return duration_cast<milliseconds>(
+			steady_clock::now().time_since_epoch()).count();
+}
+
+DnsTcpPool::DnsTcpPool(const sockaddr_in& dest, int connections)
+	: conns(connections), dest(dest)
+{
+	for (auto& conn : conns)
+	{
+		conn.sock    = -1;
+		conn.connecting = false;
+		conn.pending = 0;
+		conn.have    = 0;
+		conn.flushed = 0;
+		conn.events  = 0;
+	}
+	this->epfd = epoll_create1(EPOLL_CLOEXEC);
+}
+DnsTcpPool::~DnsTcpPool()
+{
+	for (auto& conn : conns)
+		close(conn);
+	::close(epfd);
+}
+
+bool DnsTcpPool::open(connection_t& conn)
+{
+	conn.sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+	if (conn.sock < 0) return false;
+	conn.buffer.reserve(DNS_TCP_BUFSIZE);
+	
+	// queries are small, and shouldn't wait for each other
+	int one = 1;
+	setsockopt(conn.sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	
+	// the handshake goes on without us, queries
+	// are queued until it is done
+	conn.connecting = false;
+	if (connect(conn.sock, (sockaddr*) &dest, sizeof(dest)) < 0)
+	{
+		if (errno != EINPROGRESS)
+		{
+			close(conn);
+			return false;
+		}
+		conn.connecting = true;
+	}
+	
+	epoll_event ev;
+	ev.events   = conn.connecting ? EPOLLIN | EPOLLOUT : EPOLLIN;
+	ev.data.u32 = &conn - conns.data();
+	epoll_ctl(epfd, EPOLL_CTL_ADD, conn.sock, &ev);
+	conn.events = ev.events;
+	return true;
+}
+
+void DnsTcpPool::close(connection_t& conn)
+{
+	if (conn.sock >= 0)
+	{
+		// closing the socket takes it out of epoll too
+		::close(conn.sock);
+		conn.sock = -1;
+	}
+	conn.connecting = false;
+	conn.pending = 0;
+	conn.have    = 0;
+	conn.flushed = 0;
+	conn.events  = 0;
+	conn.queued.clear();
+	conn.buffer.release();
+}
+
+void DnsTcpPool::watch(connection_t& conn)
+{
+	// writable only matters while there is something to write
+	uint32_t events = EPOLLIN;
+	if (conn.connecting || conn.flushed < conn.queued.size())
+		events |= EPOLLOUT;
+	if (events == conn.events) return;
+	
+	epoll_event ev;
+	ev.events   = events;
+	ev.data.u32 = &conn - conns.data();
+	epoll_ctl(epfd, EPOLL_CTL_MOD, conn.sock, &ev);
+	conn.events = events;
+}
+
+bool DnsTcpPool::flush(connection_t& conn)
+{
+	while (!conn.connecting && conn.flushed < conn.queued.size())
+	{
+		int sent = ::send(conn.sock, conn.queued.data() + conn.flushed,
+						  conn.queued.size() - conn.flushed, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (sent > 0)
+		{
+			conn.flushed += sent;
+			continue;
+		}
+		if (sent < 0 && errno == EINTR) continue;
+		if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+			return false;
+		// the send buffer is full, the rest goes when it drains
+		break;
+	}
+	if (conn.flushed == conn.queued.size())
+	{
+		conn.queued.clear();
+		conn.flushed = 0;
+	}
+	watch(conn);
+	return true;
+}
+
+bool DnsTcpPool::write(connection_t& conn, const char* message, int len)
+{
+	// the length goes in front of every message
+	conn.queued.push_back(len >> 8);
+	conn.queued.push_back(len);
+	conn.queued.insert(conn.queued.end(), message, message + len);
+	return flush(conn);
+}
+
+bool DnsTcpPool::writable(connection_t& conn)
+{
+	if (conn.connecting)
+	{
+		int err = 0;
+		socklen_t errlen = sizeof(err);
+		if (getsockopt(conn.sock, SOL_SOCKET, SO_ERROR, &err, &errlen) < 0 || err)
+			return false;
+		conn.connecting = false;
+	}
+	return flush(conn);
+}
+
+DnsTcpPool::connection_t* DnsTcpPool::pick()
+{
+	// an idle connection, or else a new one, or else the least busy
+	connection_t* best   = nullptr;
+	connection_t* unused = nullptr;
+	for (auto& conn : conns)
+	{
+		// servers close connections that sit idle, which
+		// shows up as the end of the stream
+		char peek;
+		if (conn.sock >= 0 && !conn.connecting && conn.pending == 0 && conn.have == 0 &&
+			recv(conn.sock, &peek, 1, MSG_PEEK | MSG_DONTWAIT) == 0)
+			close(conn);
+		
+		if (conn.sock < 0)
+		{
+			if (unused == nullptr) unused = &conn;
+		}
+		else if (best == nullptr || conn.pending < best->pending)
+			best = &conn;
+	}
+	if (unused && (best == nullptr || best->pending > 0))
+	{
+		if (open(*unused))
+			best = unused;
+	}
+	return best;
+}
+
+bool DnsTcpPool::send(const char* query, int len)
+{
+	if (len <= 0 || len > 65535) return false;
+	
+	// a connection that broke is replaced once
+	for (int attempt = 0; attempt < 2; attempt++)
+	{
+		connection_t* conn = pick();
+		if (conn == nullptr) return false;
+		
+		if (write(*conn, query, len))
+		{
+			conn->pending++;
+			return true;
+		}
+		close(*conn);
+	}
+	return false;
+}
+
+int DnsTcpPool::extract(connection_t& conn, char* buffer, int bufsize)
+{
+	if (conn.have < 2) return 0;
+	
+	const unsigned char* ubuf = (const unsigned char*) conn.buffer.data();
+	int len = ubuf[0] << 8 | ubuf[1];
+	if (conn.have < 2 + len) return 0;
+	
+	int copy = (len < bufsize) ? len : bufsize;
+	memcpy(buffer, conn.buffer.data() + 2, copy);
+	
+	// keep whatever came in after it
+	conn.have -= 2 + len;
+	memmove(conn.buffer.data(), conn.buffer.data() + 2 + len, conn.have);
+	if (conn.pending) conn.pending--;
+	return copy;
+}
+
+int DnsTcpPool::receive(char* buffer, int bufsize, int timeout_ms)
+{
+	uint64_t deadline = now_ms() + timeout_ms;
+	
+	while (true)
+	{
+		// replies already read in
+		for (auto& conn : conns)
+		{
+			int len = extract(conn, buffer, bufsize);
+			if (len) return len;
+		}
+		
+		epoll_event events[DNS_TCP_CONNECTIONS * 2];
+		int64_t left  = deadline - now_ms();
+		int     count = epoll_wait(epfd, events, sizeof(events) / sizeof(events[0]),
+								   (left > 0) ? left : 0);
+		if (count <= 0)
+		{
+			if (count < 0 && errno == EINTR) continue;
+			return 0;
+		}
+		
+		bool lost = false;
+		for (int i = 0; i < count; i++)
+		{
+			connection_t& conn = conns[events[i].data.u32];
+			if (conn.sock < 0) continue;
+			
+			// a handshake that failed shows up as an error, not as writable
+			if ((events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) &&
+				(conn.connecting || conn.flushed < conn.queued.size()) &&
+				!writable(conn))
+			{
+				if (conn.pending) lost = true;
+				close(conn);
+				continue;
+			}
+			if (conn.connecting || conn.have == DNS_TCP_BUFSIZE) continue;
+			
+			// never more than one whole message behind, so there
+			// is always room for the rest of the one in front
+			int n = recv(conn.sock, conn.buffer.data() + conn.have,
+						 DNS_TCP_BUFSIZE - conn.have, MSG_DONTWAIT);
+			if (n > 0)
+			{
+				conn.have += n;
+				continue;
+			}
+			if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+				continue;
+			
+			// the server closed the connection, or it broke
+			if (conn.pending) lost = true;
+			close(conn);
+		}
+		if (lost) return -1;
+	}
+}
+
+int DnsTcpPool::exchange(const char* query, int len, char* buffer, int bufsize, int timeout_ms)
+{
+	uint64_t deadline = now_ms() + timeout_ms;
+	
+	// a connection may have been closed by the server while it was
+	// idle, in which case the query is sent once more on a new one
+	for (int attempt = 0; attempt < 2; attempt++)
+	{
+		if (!send(query, len))
+			return 0;
+		
+		int64_t left;
+		while ((left = deadline - now_ms()) > 0)
+		{
+			int got = receive(buffer, bufsize, left);
+			
+			if (got < 0) break;  // lost, try again
+			if (got == 0) return 0;
+			if (got >= (int) sizeof(dns_header_t) &&
+				((dns_header_t*) buffer)->id == ((const dns_header_t*) query)->id)
+				return got;
+		}
+	}
+	return 0;
+}
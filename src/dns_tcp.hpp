@@ -0,0 +1,93 @@
+#ifndef DNS_TCP_HPP
+#define DNS_TCP_HPP
+
+#include "dns_buffer.hpp"
+
+#include <netinet/in.h>
+#include <vector>
+
+// connections kept open to a nameserver
+#define DNS_TCP_CONNECTIONS  2
+// a message with its two byte length in front
+#define DNS_TCP_BUFSIZE      DNS_BUFFER_LARGE
+
+/**
+ * Persistent, pipelined TCP connections to a nameserver (RFC 7766)
+ *
+ * Queries are written back to back on a few long-lived connections,
+ * without waiting for the replies to earlier ones, and replies are
+ * picked out of the byte stream as they arrive, in whatever order the
+ * server sends them. A pool talks to one nameserver for as long as it
+ * lives. Connections are opened on first use and reopened after the
+ * server closes them, so a truncated UDP answer costs one more round
+ * trip instead of a new handshake every time. Each open connection
+ * holds a large buffer from the pool.
+ *
+ * Nothing here blocks unless asked to wait: connections are opened
+ * without waiting for the handshake, and queries are queued on them,
+ * to be written out as the socket takes them. Both show up as events
+ * on fd(), and are seen to by receive().
+ *
+ * Not thread-safe.
+**/
+class DnsTcpPool
+{
+public:
+	DnsTcpPool(const sockaddr_in& dest, int connections = DNS_TCP_CONNECTIONS);
+	~DnsTcpPool();
+	
+	DnsTcpPool(const DnsTcpPool&) = delete;
+	DnsTcpPool& operator=(const DnsTcpPool&) = delete;
+	
+	// queue a query on the least busy connection, opening one if need
+	// be, returns false if there was none to queue it on
+	bool send(const char* query, int len);
+	// wait up to timeout_ms for any reply, and copy it into buffer,
+	// returns its length, 0 if none came in time, or -1 if a connection
+	// was lost with queries still unanswered, which must be sent again
+	int  receive(char* buffer, int bufsize, int timeout_ms);
+	// send query and wait for the reply with the same ID, other
+	// replies are dropped, returns its length or 0 on failure
+	int  exchange(const char* query, int len, char* buffer, int bufsize, int timeout_ms);
+	
+	// readable when there may be replies to receive(), or
+	// connections and queued queries for it to see to
+	int fd() const
+	{
+		return this->epfd;
+	}
+
+private:
+	struct connection_t
+	{
+		int   sock;
+		bool  connecting; // until the handshake is done
+		int   pending; // queries queued or written, not yet answered
+		int   have;    // bytes in buffer
+		DnsBuffer buffer; // replies being reassembled, while open
+		std::vector<char> queued; // not yet taken by the socket
+		size_t   flushed; // of queued, taken already
+		uint32_t events;  // what epoll watches the socket for
+	};
+	
+	// the connection to write the next query on
+	connection_t* pick();
+	bool open(connection_t& conn);
+	void close(connection_t& conn);
+	// queue message on conn, and write out what the socket takes
+	bool write(connection_t& conn, const char* message, int len);
+	// write out what is queued on conn, as far as the socket takes it
+	bool flush(connection_t& conn);
+	// conn is writable, or its handshake is over
+	bool writable(connection_t& conn);
+	// have epoll watch conn for what it is waiting on
+	void watch(connection_t& conn);
+	// move a whole reply out of conn, returns its length or 0
+	int  extract(connection_t& conn, char* buffer, int bufsize);
+	
+	std::vector<connection_t> conns;
+	sockaddr_in dest;
+	int epfd;
+};
+
+#endif
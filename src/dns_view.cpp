@@ -0,0 +1,149 @@
+#include "dns_view.hpp"
+
+#include <arpa/inet.h>
+
+int DnsView::checkName(const unsigned char* packet, int len, int offset)
+{
+	int end   = -1;     // where the name ends in the packet
+	int total = 0;      // length once decompressed
+	int limit = offset; // pointers must go back further than this
+	int pos   = offset;
+	
+	while (pos < len)
+	{
+		unsigned label = packet[pos];
+		
+		if (label >= 192)
+		{
+			if (pos + 1 >= len) return -1;
+			int target = (label & 0x3f) << 8 | packet[pos + 1];
+			
+			// only the first pointer moves us forward in the packet
+			if (end < 0) end = pos + 2;
+			// strictly backwards every time, so we can't loop
+			if (target >= limit) return -1;
+			
+			limit = pos = target;
+		}
+		else if (label >= 64)
+		{
+			return -1; // extended label types aren't supported
+		}
+		else if (label == 0)
+		{
+			return (end < 0) ? pos + 1 : end;
+		}
+		else
+		{
+			total += label + 1;
+			if (total >= DNS_NAME_MAX) return -1;
+			pos += label + 1;
+		}
+	}
+	return -1; // ran off the end of the packet
+}
+
+bool DnsView::parse(const char* packet, int len)
+{
+	const unsigned char* upacket = (const unsigned char*) packet;
+	
+	this->packet = packet;
+	this->length = len;
+	this->stored = 0;
+	this->overflow = false;
+	
+	if (len < (int) sizeof(dns_header_t) || len > 65535) return false;
+	const dns_header_t& dns = header();
+	
+	// questions, we only keep the first one
+	int pos = sizeof(dns_header_t);
+	int questions = ntohs(dns.q_count);
+	
+	if (questions == 0) return false;
+	for (int i = 0; i < questions; i++)
+	{
+		int name = pos;
+		pos = checkName(upacket, len, pos);
+		if (pos < 0 || len - pos < (int) sizeof(dns_question_t)) return false;
+		
+		if (i == 0)
+		{
+			this->question = name;
+			this->q_type   = upacket[pos]     << 8 | upacket[pos + 1];
+			this->q_class  = upacket[pos + 2] << 8 | upacket[pos + 3];
+		}
+		pos += sizeof(dns_question_t);
+	}
+	
+	const int sections[3] =
+	{
+		ntohs(dns.ans_count), ntohs(dns.auth_count), ntohs(dns.add_count)
+	};
+	
+	for (int s = 0; s < 3; s++)
+	{
+		first[s]  = stored;
+		counts[s] = 0;
+		
+		for (int i = 0; i < sections[s]; i++)
+		{
+			int name = pos;
+			pos = checkName(upacket, len, pos);
+			if (pos < 0 || len - pos < (int) sizeof(dns_rr_data_t)) return false;
+			
+			const dns_rr_data_t* rr = (const dns_rr_data_t*) (packet + pos);
+			pos += sizeof(dns_rr_data_t);
+			
+			int rdlength = ntohs(rr->data_len);
+			if (len - pos < rdlength) return false;
+			
+			if (stored < DNS_VIEW_MAX_RECORDS)
+			{
+				dns_rr_view_t& view = rrs[stored++];
+				view.name   = name;
+				view.type   = ntohs(rr->type);
+				view._class = ntohs(rr->_class);
+				view.ttl    = ntohl(rr->ttl);
+				view.rdata  = pos;
+				view.rdlength = rdlength;
+				counts[s]++;
+			}
+			else overflow = true;
+			
+			pos += rdlength;
+		}
+	}
+	return true;
+}
+
+int DnsView::readName(const char* packet, int len, int offset, char* out, int outlen)
+{
+	const unsigned char* upacket = (const unsigned char*) packet;
+	
+	// make sure the name is sound before following it
+	if (checkName(upacket, len, offset) < 0) return -1;
+	
+	int p = 0;
+	unsigned pos = offset;
+	
+	while (upacket[pos])
+	{
+		unsigned label = upacket[pos];
+		
+		if (label >= 192)
+		{
+			pos = (label & 0x3f) << 8 | upacket[pos + 1];
+			continue;
+		}
+		// room for the label, a dot and the terminating zero
+		if (p + (int) label + 2 > outlen) return -1;
+		
+		if (p) out[p++] = '.';
+		memcpy(out + p, upacket + pos + 1, label);
+		p   += label;
+		pos += label + 1;
+	}
+	if (outlen < 1) return -1;
+	out[p] = '\0';
+	return p;
+}
@@ -0,0 +1,114 @@
+#ifndef DNS_VIEW_HPP
+#define DNS_VIEW_HPP
+
+#include "dns.hpp"
+
+#include <stdint.h>
+
+// records beyond this are validated, but not kept
+#define DNS_VIEW_MAX_RECORDS  64
+
+// a resource record, as it lies in the packet
+struct dns_rr_view_t
+{
+	uint16_t name;     // offset of the owner name
+	uint16_t type;
+	uint16_t _class;
+	uint32_t ttl;
+	uint16_t rdata;    // offset of the rdata
+	uint16_t rdlength;
+};
+
+enum dns_section_t
+{
+	DNS_ANSWER     = 0,
+	DNS_AUTHORITY  = 1,
+	DNS_ADDITIONAL = 2,
+};
+
+/**
+ * Zero-copy response parser
+ * 
+ * Borrows the receive buffer instead of copying out of it: records
+ * are kept as offsets into the packet, in a fixed-size array, and
+ * names are only decompressed when asked for. Every label, pointer
+ * and length is checked against the packet size while parsing, and
+ * compression pointers must point backwards, so no packet can make
+ * the parser loop or read outside the buffer.
+ * 
+ * The packet must outlive the view.
+**/
+class DnsView
+{
+public:
+	DnsView() : packet(nullptr), length(0), stored(0), overflow(false) {}
+	
+	// parse a packet of len bytes, returns false if it is malformed
+	bool parse(const char* packet, int len);
+	
+	const dns_header_t& header() const
+	{
+		return *(const dns_header_t*) packet;
+	}
+	// the first question
+	uint16_t qname() const
+	{
+		return this->question;
+	}
+	uint16_t qtype() const
+	{
+		return this->q_type;
+	}
+	uint16_t qclass() const
+	{
+		return this->q_class;
+	}
+	
+	// records kept from a section, and how many of them
+	const dns_rr_view_t* records(dns_section_t section) const
+	{
+		return &this->rrs[first[section]];
+	}
+	int count(dns_section_t section) const
+	{
+		return this->counts[section];
+	}
+	// true if the packet had more records than could be kept
+	bool overflowed() const
+	{
+		return this->overflow;
+	}
+	
+	const char* rdata(const dns_rr_view_t& rr) const
+	{
+		return packet + rr.rdata;
+	}
+	// decompress the name at offset into out as www.google.com, returns
+	// its length, or -1 if out is too small or the name isn't valid
+	int readName(uint16_t offset, char* out, int outlen) const
+	{
+		return readName(packet, length, offset, out, outlen);
+	}
+	// same, for a name in any packet of len bytes
+	static int readName(const char* packet, int len, int offset, char* out, int outlen);
+	
+	// check the name at offset, returns the offset just past
+	// where it lies in the packet, or -1 if it is malformed
+	static int checkName(const unsigned char* packet, int len, int offset);
+	
+private:
+	const char* packet;
+	int length;
+	
+	uint16_t question;
+	uint16_t q_type;
+	uint16_t q_class;
+	
+	dns_rr_view_t rrs[DNS_VIEW_MAX_RECORDS];
+	int  first[3];
+	int  counts[3];
+	int  stored;
+	bool overflow;
+};
+
+#endif
@@ -0,0 +1,261 @@
+#include "iterative_dns.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <ctype.h>
+
+// a.root-servers.net to m.root-servers.net
+static const char* ROOT_HINTS[] =
+{
+	"198.41.0.4",     "170.247.170.2", "192.33.4.12",    "199.7.91.13",
+	"192.203.230.10", "192.5.5.241",   "192.112.36.4",   "198.97.190.53",
+	"192.36.148.17",  "192.58.128.30", "193.0.14.129",   "199.7.83.42",
+	"202.12.27.33",
+};
+
+// never trust a zone cut for longer than this
+#define ITER_MAX_TTL  86400
+
+static uint64_t now_s()
+{
+	using namespace std::chrono;
+	return duration_cast<seconds>(
+			steady_clock::now().time_since_epoch()).count();
+}
+
+// www.Google.com. as www.google.com
+static std::string canonical(const std::string& name)
+{
+	std::string out(name);
+	if (!out.empty() && out.back() == '.') out.pop_back();
+	for (auto& c : out) c = tolower((unsigned char) c);
+	return out;
+}
+
+// true if name is zone or lies below it, both canonical
+static bool within(const std::string& name, const std::string& zone)
+{
+	if (zone.empty()) return true;
+	if (name.size() < zone.size()) return false;
+	if (name.size() == zone.size()) return name == zone;
+	
+	return name[name.size() - zone.size() - 1] == '.' &&
+		   name.compare(name.size() - zone.size(), zone.size(), zone) == 0;
+}
+
+static sockaddr_in address(const uint8_t* a, unsigned short port)
+{
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port   = htons(port);
+	memcpy(&addr.sin_addr.s_addr, a, 4);
+	return addr;
+}
+
+IterativeDNS::IterativeDNS()
+	: LinuxDNS(), rcode(NO_ERROR)
+{
+	// we do the recursing
+	set_recursion(false);
+	
+	std::vector<std::string> hints(ROOT_HINTS, ROOT_HINTS + sizeof(ROOT_HINTS) / sizeof(ROOT_HINTS[0]));
+	set_roots(hints);
+}
+
+void IterativeDNS::set_roots(const std::vector<std::string>& addresses, unsigned short port)
+{
+	nameservers.clear();
+	tcp.clear();
+	cuts.clear();
+	
+	delegation_t& root = cuts[""];
+	root.expires = 0;
+	
+	for (auto& ip : addresses)
+	{
+		in_addr_t a = inet_addr(ip.c_str());
+		root.servers.push_back(nameservers.add(address((const uint8_t*) &a, port)));
+	}
+}
+
+bool IterativeDNS::resolve(const std::string& hostname, unsigned short qtype)
+{
+	chain.clear();
+	return walk(hostname, qtype, chain, 0);
+}
+
+std::string IterativeDNS::closest(const std::string& name)
+{
+	std::string zone = canonical(name);
+	uint64_t now = now_s();
+	
+	while (true)
+	{
+		auto it = cuts.find(zone);
+		if (it != cuts.end())
+		{
+			if (it->second.expires == 0 || it->second.expires > now)
+				return zone;
+			cuts.erase(it);
+		}
+		if (zone.empty()) return zone;
+		
+		size_t dot = zone.find('.');
+		zone = (dot == std::string::npos) ? "" : zone.substr(dot + 1);
+	}
+}
+
+bool IterativeDNS::findServers(const std::string& zone, std::vector<int>& servers, int depth)
+{
+	auto it = cuts.find(zone);
+	if (it == cuts.end()) return false;
+	
+	// the lookups below may well learn, or forget, other zone cuts
+	std::vector<std::string> names = it->second.names;
+	
+	for (auto& name : names)
+	{
+		std::vector<dns_rr_t> found;
+		if (!walk(name, DNS_TYPE_A, found, depth + 1)) continue;
+		
+		for (auto& rr : found)
+		{
+			if (rr.rdata.kind == RDATA_A)
+				servers.push_back(nameservers.add(address(rr.rdata.a, DNS_PORT)));
+		}
+		if (!servers.empty()) break;
+	}
+	
+	it = cuts.find(zone);
+	if (it != cuts.end()) it->second.servers = servers;
+	return !servers.empty();
+}
+
+bool IterativeDNS::walk(std::string qname, unsigned short qtype,
+						std::vector<dns_rr_t>& chain, int depth)
+{
+	this->rcode = SERVER_FAIL;
+	if (depth > ITER_MAX_DEPTH) return false;
+	
+	for (int cnames = 0; cnames <= ITER_MAX_CNAMES; cnames++)
+	{
+		std::string target = canonical(qname);
+		std::string zone   = closest(target);
+		std::string alias;
+		
+		for (int step = 0; step < ITER_MAX_REFERRALS && alias.empty(); step++)
+		{
+			auto it = cuts.find(zone);
+			if (it == cuts.end()) return false;
+			
+			std::vector<int> servers = it->second.servers;
+			if (servers.empty() && !findServers(zone, servers, depth))
+			{
+				this->rcode = SERVER_FAIL;
+				return false;
+			}
+			
+			// ask only the nameservers of the zone
+			nameservers.restrict(servers);
+			bool answered = request(qname, qtype);
+			nameservers.restrict(std::vector<int>());
+			
+			this->rcode = answered ? (int) req.getHeader().rcode : (int) SERVER_FAIL;
+			if (rcode == NAME_ERROR) return true;
+			if (rcode != NO_ERROR) return false;
+			
+			// follow the CNAMEs in the answer as far as they go
+			const dns_records_t& answers = req.getAnswers();
+			std::string name = target;
+			
+			for (int i = 0; i < ITER_MAX_CNAMES && qtype != DNS_TYPE_CNAME; i++)
+			{
+				auto rr = std::find_if(answers.begin(), answers.end(),
+				[&name] (const dns_rr_t& rr)
+				{
+					return rr.type() == DNS_TYPE_CNAME &&
+						   rr.rdata.kind == RDATA_NAME && canonical(rr.name) == name;
+				});
+				if (rr == answers.end()) break;
+				
+				chain.push_back(*rr);
+				name = canonical(rr->rdata.name());
+			}
+			
+			bool found = false;
+			for (auto& rr : answers)
+			{
+				if ((rr.type() == qtype || qtype == DNS_TYPE_ANY) && canonical(rr.name) == name)
+				{
+					chain.push_back(rr);
+					found = true;
+				}
+			}
+			if (found) return true;
+			
+			// an alias to look up from its own closest zone cut
+			if (name != target)
+			{
+				alias = name;
+				break;
+			}
+			
+			// a referral to a zone below the one we asked
+			std::string child;
+			delegation_t next;
+			uint32_t ttl = ITER_MAX_TTL;
+			bool lame = false;
+			
+			for (auto& rr : req.getAuthority())
+			{
+				if (rr.type() != DNS_TYPE_NS || rr.rdata.kind != RDATA_NAME)
+					continue;
+				
+				std::string owner = canonical(rr.name);
+				if (owner == zone || !within(owner, zone) || !within(target, owner))
+				{
+					lame = true;
+					continue;
+				}
+				if (child.empty()) child = owner;
+				if (owner != child) continue;
+				
+				next.names.push_back(canonical(rr.rdata.name()));
+				ttl = std::min(ttl, (uint32_t) ntohl(rr.resource.ttl));
+			}
+			if (child.empty())
+			{
+				// nowhere else to go, so there are no such records,
+				// unless the nameserver pointed sideways or back up
+				if (lame) this->rcode = SERVER_FAIL;
+				return !lame;
+			}
+			
+			// glue, as long as it lies within the zone we asked
+			for (auto& rr : req.getAdditional())
+			{
+				if (rr.rdata.kind != RDATA_A) continue;
+				
+				std::string owner = canonical(rr.name);
+				if (!within(owner, zone) ||
+					std::find(next.names.begin(), next.names.end(), owner) == next.names.end())
+					continue;
+				
+				int server = nameservers.add(address(rr.rdata.a, DNS_PORT));
+				if (std::find(next.servers.begin(), next.servers.end(), server) == next.servers.end())
+					next.servers.push_back(server);
+			}
+			next.expires = now_s() + std::max(ttl, 1u);
+			cuts[child] = next;
+			zone = child;
+		}
+		
+		// too many referrals
+		if (alias.empty()) return false;
+		qname = alias;
+	}
+	// too many CNAMEs
+	this->rcode = SERVER_FAIL;
+	return false;
+}
@@ -0,0 +1,82 @@
+#ifndef ITERATIVE_DNS_HPP
+#define ITERATIVE_DNS_HPP
+
+#include "linux_dns.hpp"
+
+#include <unordered_map>
+
+// CNAMEs followed for one lookup, at most
+#define ITER_MAX_CNAMES     8
+// referrals followed for one name, at most
+#define ITER_MAX_REFERRALS 16
+// lookups of nameserver addresses within a lookup, nested at most
+#define ITER_MAX_DEPTH      4
+
+/**
+ * Resolver that walks the tree itself, instead of asking a recursor
+ *
+ * A lookup starts at the closest zone cut it knows of, the root (from
+ * the root hints) the first time, and asks that zone's nameservers,
+ * without recursion. Referrals are followed down using the glue in the
+ * additional section, or by looking up the nameservers' addresses when
+ * there isn't any, and CNAMEs are chased from the closest known cut of
+ * their target. Every zone cut learned is kept for as long as its NS
+ * records live, so later lookups skip the levels above it.
+ *
+ * Answers also go through the cache, if there is one, like those from
+ * a recursor would.
+**/
+class IterativeDNS : public LinuxDNS
+{
+public:
+	IterativeDNS();
+	
+	// start from these root nameservers instead of the built-in hints,
+	// forgetting every zone cut learned so far
+	void set_roots(const std::vector<std::string>& addresses, unsigned short port = DNS_PORT);
+	
+	// resolve hostname, returns true when a nameserver for it gave a
+	// definite answer (which may be that there's no such name, or no
+	// records of that type), false if none could be had
+	bool resolve(const std::string& hostname, unsigned short qtype = DNS_TYPE_A);
+	
+	// the records answering the last lookup, after the CNAMEs that led to them
+	const std::vector<dns_rr_t>& getAnswers() const
+	{
+		return this->chain;
+	}
+	// the response code of the last lookup
+	int getResponseCode() const
+	{
+		return this->rcode;
+	}
+	// zone cuts known, including the root
+	size_t delegations() const
+	{
+		return this->cuts.size();
+	}
+
+private:
+	struct delegation_t
+	{
+		std::vector<std::string> names; // of the nameservers
+		std::vector<int> servers;       // addresses known for them
+		uint64_t expires;               // s, or 0 for never
+	};
+	
+	bool walk(std::string qname, unsigned short qtype,
+			  std::vector<dns_rr_t>& chain, int depth);
+	// the closest zone cut above or at name that hasn't expired
+	std::string closest(const std::string& name);
+	// look up the addresses of the nameservers of zone, for lack
+	// of glue, into servers, and remember them with the zone cut
+	bool findServers(const std::string& zone, std::vector<int>& servers, int depth);
+	
+	// zone cuts by zone name, lowercase and without the final dot,
+	// the root being the empty name
+	std::unordered_map<std::string, delegation_t> cuts;
+	std::vector<dns_rr_t> chain;
+	int rcode;
+};
+
+#endif
@@ -0,0 +1,342 @@
+#include "linux_dns.hpp"
+
+#include <chrono>
+#include <deque>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+
+typedef std::chrono::steady_clock batch_clock;
+
+LinuxDNS::LinuxDNS()
+	: AbstractRequest(), timeout_ms(5000),
+	  queryLength(0), responder(-1)
+{
+	this->sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+	this->attempt.server = -1;
+}
+LinuxDNS::~LinuxDNS()
+{
+	if (this->sock >= 0) close(this->sock);
+}
+
+bool LinuxDNS::sendTo(int server, const char* query, int len, dns_attempt_t& attempt)
+{
+	const sockaddr_in& dest = nameservers.address(server);
+	nameservers.sent(attempt, server);
+	
+	int sent = sendto(sock, query, len, 0, (struct sockaddr*) &dest, sizeof(dest));
+	return sent != SOCKET_ERROR || errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+DnsTcpPool& LinuxDNS::tcpTo(int server)
+{
+	if ((int) tcp.size() <= server)
+		tcp.resize(server + 1);
+	if (!tcp[server])
+	{
+		tcp[server].reset(new DnsTcpPool(nameservers.address(server)));
+		addedTCP(server, *tcp[server]);
+	}
+	return *tcp[server];
+}
+
+int LinuxDNS::sendTCP(int server, const char* query, int len)
+{
+	if (tcpTo(server).send(query, len))
+		return server;
+	
+	int next = nameservers.pick(server);
+	if (next != server && tcpTo(next).send(query, len))
+		return next;
+	return -1;
+}
+
+bool LinuxDNS::send(const std::string& hostname, int messageSize)
+{
+	// send request to the fastest nameserver
+	printf("Resolving %s...", hostname.c_str());
+	this->attempt.server = -1;
+	this->queryLength = messageSize;
+	
+	int server = nameservers.pick();
+	if (server < 0)
+	{
+		printf("no nameservers\n");
+		return false;
+	}
+	if (!sendTo(server, query, messageSize, attempt))
+	{
+		printf("error %d: %s\n", errno, strerror(errno));
+		return false;
+	}
+	printf("Done\n");
+	return true;
+}
+
+bool LinuxDNS::read()
+{
+	printf("Receiving answer...");
+	uint64_t deadline = attempt.sent_us + (uint64_t) timeout_ms * 1000;
+	uint64_t hedge    = attempt.sent_us + nameservers.timeout(attempt.server) * 1000;
+	
+	while (true)
+	{
+		uint64_t now = DnsNameservers::now_us();
+		if (now >= deadline)
+		{
+			nameservers.failed(attempt.server);
+			printf("timed out\n");
+			return false;
+		}
+		if (now >= hedge)
+		{
+			// too slow, ask the next nameserver as well
+			nameservers.failed(attempt.server);
+			int server = nameservers.pick(attempt.server);
+			sendTo(server, query, queryLength, attempt);
+			hedge = now + nameservers.timeout(server) * 1000;
+			continue;
+		}
+		
+		pollfd pfd = { sock, POLLIN, 0 };
+		int wait  = (std::min(deadline, hedge) - now + 999) / 1000;
+		int ready = poll(&pfd, 1, wait);
+		if (ready == SOCKET_ERROR && errno != EINTR)
+		{
+			printf("error %d: %s\n", errno, strerror(errno));
+			return false;
+		}
+		if (ready <= 0) continue;
+		
+		sockaddr_in from;
+		socklen_t fromlen = sizeof(from);
+		int readBytes = recvfrom(sock, buffer.data(), buffer.capacity(), MSG_DONTWAIT, (struct sockaddr*) &from, &fromlen);
+		if (readBytes <= 0) continue;
+		
+		// only the answer to this request, from a nameserver we asked,
+		// late answers to earlier requests are passed over
+		int server = nameservers.find(from);
+		if (server < 0 || !req.matchesResponse(buffer.data(), readBytes))
+			continue;
+		
+		nameservers.answered(attempt, server);
+		printf("Received.\n");
+		this->received  = readBytes;
+		this->responder = server;
+		return true;
+	}
+}
+
+bool LinuxDNS::readTCP(int messageSize)
+{
+	printf("Truncated, asking over TCP...");
+	buffer.reserve(DNS_BUFFER_LARGE);
+	int readBytes = tcpTo(responder).exchange(query, messageSize, buffer.data(), buffer.capacity(), timeout_ms);
+	
+	// maybe the nameserver won't take TCP, but the next one will
+	int next = nameservers.pick(responder);
+	if (readBytes == 0 && next != responder)
+		readBytes = tcpTo(next).exchange(query, messageSize, buffer.data(), buffer.capacity(), timeout_ms);
+	
+	if (readBytes == 0)
+	{
+		printf("failed\n");
+		return false;
+	}
+	printf("Received.\n");
+	this->received = readBytes;
+	return true;
+}
+
+std::vector<dns_batch_result_t> LinuxDNS::resolveBatch(
+		const std::vector<std::string>& hostnames,
+		int window, int timeout_ms, unsigned short qtype)
+{
+	// at least one query in flight, and never more than there are IDs for
+	window = std::max(1, std::min(window, 65535));
+	
+	std::vector<dns_batch_result_t> results(hostnames.size());
+	
+	// index of the in-flight query using each ID, -1 when unused
+	std::vector<int> inflight(65536, -1);
+	// queries in the order they were sent, which is also deadline order
+	std::deque<std::pair<batch_clock::time_point, int>> deadlines;
+	// when to ask another nameserver as well, in about the same order
+	std::deque<std::pair<batch_clock::time_point, int>> hedges;
+	std::vector<dns_attempt_t> attempts(hostnames.size());
+	std::vector<pollfd> pfds;
+	
+	const auto timeout = std::chrono::milliseconds(timeout_ms);
+	size_t next = 0;
+	int outstanding = 0;
+	
+	while (next < hostnames.size() || outstanding > 0)
+	{
+		// fill up the window, back to back
+		while (next < hostnames.size() && outstanding < window)
+		{
+			dns_batch_result_t& res = results[next];
+			res.resolved = false;
+			
+			int messageSize = res.req.createRequest(query, hostnames[next], qtype,
+													DNS_CLASS_INET, flags, edns);
+			// IDs are drawn at random, never reuse one still in flight
+			while (inflight[res.req.getID()] != -1)
+				messageSize = res.req.createRequest(query, hostnames[next], qtype,
+													DNS_CLASS_INET, flags, edns);
+			
+			if (messageSize == 0)
+			{
+				printf("Resolving %s... invalid name\n", hostnames[next].c_str());
+				next++;
+				continue;
+			}
+			
+			if (cachedResponse(res.req))
+			{
+				res.resolved = true;
+				next++;
+				continue;
+			}
+			
+			dns_attempt_t& attempt = attempts[next];
+			attempt.server = -1;
+			
+			int server = nameservers.pick();
+			if (server < 0 || !sendTo(server, query, messageSize, attempt))
+			{
+				printf("Resolving %s... error %d: %s\n", hostnames[next].c_str(), errno, strerror(errno));
+				next++;
+				continue;
+			}
+			inflight[res.req.getID()] = next;
+			deadlines.emplace_back(batch_clock::now() + timeout, next);
+			hedges.emplace_back(batch_clock::now() +
+					std::chrono::milliseconds(nameservers.timeout(server)), next);
+			outstanding++;
+			next++;
+		}
+		
+		// retire answered queries from the front, and expire timed out ones
+		auto now = batch_clock::now();
+		while (!deadlines.empty())
+		{
+			int idx = deadlines.front().second;
+			unsigned short id = results[idx].req.getID();
+			
+			if (inflight[id] == idx)
+			{
+				if (deadlines.front().first > now) break;
+				// timed out
+				nameservers.failed(attempts[idx].server);
+				inflight[id] = -1;
+				outstanding--;
+			}
+			deadlines.pop_front();
+		}
+		if (outstanding == 0) continue;
+		
+		// ask another nameserver as well, once, for queries
+		// the first one is taking too long to answer
+		while (!hedges.empty() && hedges.front().first <= now)
+		{
+			int idx = hedges.front().second;
+			DnsRequest& req = results[idx].req;
+			hedges.pop_front();
+			
+			if (inflight[req.getID()] != idx) continue;
+			
+			dns_attempt_t& attempt = attempts[idx];
+			nameservers.failed(attempt.server);
+			int messageSize = req.writeRequest(query);
+			sendTo(nameservers.pick(attempt.server), query, messageSize, attempt);
+		}
+		
+		// wait for replies, but no longer than the oldest deadline
+		auto until = deadlines.front().first;
+		if (!hedges.empty() && hedges.front().first < until)
+			until = hedges.front().first;
+		auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(
+				until - now).count() + 1;
+		
+		// the socket, and the TCP connections to whoever has them
+		pfds.assign(1, pollfd { sock, POLLIN, 0 });
+		for (auto& pool : tcp)
+			if (pool) pfds.push_back(pollfd { pool->fd(), POLLIN, 0 });
+		
+		int ready = poll(pfds.data(), pfds.size(), wait);
+		if (ready == SOCKET_ERROR && errno != EINTR)
+		{
+			printf("poll error %d: %s\n", errno, strerror(errno));
+			break;
+		}
+		if (ready <= 0) continue;
+		
+		// take a reply of readBytes in buffer, from server
+		auto accept =
+		[&] (int readBytes, int server, bool overTCP)
+		{
+			if (readBytes < (int) sizeof(dns_header_t))
+				return;
+			
+			int idx = inflight[((dns_header_t*) buffer.data())->id];
+			// late reply to a query that already timed out, or garbage
+			if (idx < 0) return;
+			
+			DnsRequest& req = results[idx].req;
+			if (!req.matchesResponse(buffer.data(), readBytes))
+				return;
+			
+			// too big for UDP, ask again over TCP, a query
+			// that can't be sent is left to time out
+			if (((dns_header_t*) buffer.data())->tc && !overTCP)
+			{
+				DnsMetrics::count(DNS_UPSTREAM_TRUNCATED);
+				int messageSize = req.writeRequest(query);
+				sendTCP(server, query, messageSize);
+				// with room for what comes back
+				buffer.reserve(DNS_BUFFER_LARGE);
+				return;
+			}
+			if (!req.parseResponse(buffer.data(), readBytes))
+				return;
+			countAnswer(req);
+			
+			if (!overTCP)
+				nameservers.answered(attempts[idx], server);
+			results[idx].resolved = true;
+			
+			if (cache)
+				cache->store(req.getName(), req.getType(), req.getClass(), buffer.data(), readBytes);
+			inflight[req.getID()] = -1;
+			outstanding--;
+		};
+		
+		// drain everything that has arrived
+		sockaddr_in from;
+		socklen_t fromlen = sizeof(from);
+		int readBytes;
+		
+		while ((readBytes = recvfrom(sock, buffer.data(), buffer.capacity(), MSG_DONTWAIT, (struct sockaddr*) &from, &fromlen)) > 0)
+		{
+			fromlen = sizeof(from);
+			
+			// only accept replies from the nameservers we ask
+			int server = nameservers.find(from);
+			if (server < 0) continue;
+			accept(readBytes, server, false);
+		}
+		// queries on a lost connection are left to time out
+		for (int server = 0; server < (int) tcp.size(); server++)
+		{
+			if (!tcp[server]) continue;
+			while ((readBytes = tcp[server]->receive(buffer.data(), buffer.capacity(), 0)) != 0)
+			{
+				if (readBytes > 0)
+					accept(readBytes, server, true);
+			}
+		}
+	}
+	return results;
+}
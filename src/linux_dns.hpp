@@ -2,67 +2,98 @@
 #define LINUX_DNS_HPP
 
 #include "dns_request.hpp"
+#include "dns_nameservers.hpp"
+#include "dns_tcp.hpp"
 
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <errno.h>
+#include <memory>
 
 #define SOCKET_ERROR  -1
 typedef int socket_t;
 
+// outcome of one lookup in a batch
+struct dns_batch_result_t
+{
+	DnsRequest req;
+	bool resolved; // false if the query was lost or timed out
+};
+
 class LinuxDNS : public AbstractRequest
 {
 public:
-	LinuxDNS() : AbstractRequest() {}
+	LinuxDNS();
+	~LinuxDNS();
 	
+	// ask nameserver, and only nameserver, from now on
 	void set_ns(const std::string& nameserver)
 	{
-		sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-		
-		// destination nameserver
-		dest.sin_family = AF_INET;
-		dest.sin_port   = htons(DNS_PORT);
-		dest.sin_addr.s_addr = inet_addr(nameserver.c_str());
+		nameservers.clear();
+		tcp.clear();
+		add_ns(nameserver);
+	}
+	// ask nameserver too, each query goes to the fastest one that is
+	// answering, and to the next fastest as well if it is slow to
+	void add_ns(const std::string& nameserver, unsigned short port = DNS_PORT)
+	{
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port   = htons(port);
+		addr.sin_addr.s_addr = inet_addr(nameserver.c_str());
+		nameservers.add(addr);
 	}
 	
-private:
-	bool send(const std::string& hostname, int messageSize)
+	// give up waiting for a response in request() after timeout_ms
+	void set_timeout(int timeout_ms)
 	{
-		// send request to nameserver
-		printf("Resolving %s...", hostname.c_str());
-		int sent = sendto(sock, buffer, messageSize, 0, (struct sockaddr*) &dest, sizeof(dest));
-		
-		if (sent == SOCKET_ERROR)
-		{
-			printf("error %d: %s\n", errno, strerror(errno));
-			return false;
-		}
-		printf("Done\n");
-		return true;
+		this->timeout_ms = timeout_ms;
 	}
-	bool read()
+	
+	// resolve many hostnames over the one socket, keeping up to window
+	// queries in flight and matching replies by ID and question,
+	// a query not answered within timeout_ms is given up on
+	std::vector<dns_batch_result_t> resolveBatch(
+			const std::vector<std::string>& hostnames,
+			int window = 64, int timeout_ms = 2000,
+			unsigned short qtype = DNS_TYPE_A);
+	
+private:
+	bool send(const std::string& hostname, int messageSize);
+	bool read();
+	bool readTCP(int messageSize);
+	
+protected:
+	// send len bytes of query to server, recording it in attempt,
+	// false if it couldn't be sent (a full send buffer is like a
+	// lost packet, and counts as sent)
+	bool sendTo(int server, const char* query, int len, dns_attempt_t& attempt);
+	// the TCP connections to server, made on first use
+	DnsTcpPool& tcpTo(int server);
+	// a pool of TCP connections to server was just made, for
+	// whoever waits on their replies along with everything else
+	virtual void addedTCP(int server, DnsTcpPool& pool)
 	{
-		// read response
-		socklen_t read_len = sizeof(dest);
-		int readBytes = recvfrom(sock, buffer, 65536, 0, (struct sockaddr*) &dest, &read_len);
-		
-		printf("Receiving answer...");
-		if (readBytes == SOCKET_ERROR)
-		{
-			printf("error %d: %s\n", errno, strerror(errno));
-		}
-		else if (readBytes == 0)
-		{
-			printf("closed prematurely\n");
-			return false;
-		}
-		printf("Received.\n");
-		return true;
+		(void) server;
+		(void) pool;
 	}
+	// queue query over TCP to server, or to the next fastest nameserver
+	// if that one won't take it, returns the one it went to or -1
+	int  sendTCP(int server, const char* query, int len);
+	
+	DnsNameservers nameservers;
+	socket_t sock; // one socket for every nameserver
+	int timeout_ms;
+	// for answers too big for UDP, by nameserver, null until used
+	std::vector<std::unique_ptr<DnsTcpPool>> tcp;
 	
-	sockaddr_in dest;
-	socket_t sock;
+	// the query request() is waiting for, and who answered it
+	dns_attempt_t attempt;
+	int queryLength;
+	int responder;
 };
 
 #endif
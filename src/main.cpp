@@ -13,13 +13,18 @@ int main(int argc, char** argv)
 	// set nameserver
 	dns.set_ns(argv[1]);
 	
-	// dig up some dirt
-	if (dns.request("www.google.com"))
-		dns.print();
-	if (dns.request("www.fwsnet.net"))
-		dns.print();
-	if (dns.request("www.vg.no"))
-		dns.print();
+	// dig up some dirt, all at once
+	std::vector<std::string> hostnames =
+		{ "www.google.com", "www.fwsnet.net", "www.vg.no" };
+	
+	for (auto& result : dns.resolveBatch(hostnames))
+	{
+		printf("%s:\n", result.req.getHostname().c_str());
+		if (result.resolved)
+			result.req.print();
+		else
+			printf(" timed out\n\n");
+	}
 	
 	return 0;
 }
@@ -0,0 +1,102 @@
+#ifndef TIMER_WHEEL_HPP
+#define TIMER_WHEEL_HPP
+
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Hashed timer wheel
+ * 
+ * Timers are put in the slot for the tick they expire on, and the
+ * wheel is walked one tick at a time as the clock moves forward.
+ * Timers further away than one full turn stay in their slot until
+ * the wheel has come around enough times.
+ * 
+ * Timers are identified by a cookie only, and can't be cancelled.
+ * The owner is expected to check if a cookie is still relevant
+ * when it fires (eg. by putting a generation number in it).
+**/
+class TimerWheel
+{
+public:
+	TimerWheel(unsigned tick_ms, unsigned slots)
+		: tick(tick_ms), wheel(slots), current(0), count(0) {}
+	
+	// start turning the wheel at the given time
+	void reset(uint64_t now_ms)
+	{
+		current = now_ms / tick;
+	}
+	
+	// fire cookie once the clock reaches when_ms
+	void schedule(uint64_t when_ms, uint64_t cookie)
+	{
+		uint64_t when = when_ms / tick;
+		// never schedule into a slot we have already passed
+		if (when < current) when = current;
+		
+		wheel[when % wheel.size()].push_back(entry_t { when, cookie });
+		count++;
+	}
+	
+	// move the wheel forward to now_ms, calling expired(cookie)
+	// for each timer that has run out
+	template <typename Func>
+	void advance(uint64_t now_ms, Func expired)
+	{
+		uint64_t target = now_ms / tick;
+		
+		while (current <= target && count)
+		{
+			std::vector<entry_t>& slot = wheel[current % wheel.size()];
+			
+			// pick out the timers for this turn before calling
+			// anyone, since callbacks may schedule new timers
+			fired.clear();
+			size_t keep = 0;
+			for (size_t i = 0; i < slot.size(); i++)
+			{
+				if (slot[i].when <= current)
+					fired.push_back(slot[i].cookie);
+				else
+					slot[keep++] = slot[i];
+			}
+			slot.resize(keep);
+			count -= fired.size();
+			
+			// move on first, so timers scheduled from the
+			// callbacks land in a slot that is yet to come
+			current++;
+			
+			for (uint64_t cookie : fired)
+				expired(cookie);
+		}
+		// nothing left to fire, just catch up with the clock
+		if (current <= target) current = target + 1;
+	}
+	
+	// number of timers waiting to fire
+	size_t size() const
+	{
+		return count;
+	}
+	unsigned tick_ms() const
+	{
+		return tick;
+	}
+	
+private:
+	struct entry_t
+	{
+		uint64_t when; // in ticks
+		uint64_t cookie;
+	};
+	
+	unsigned tick;
+	std::vector<std::vector<entry_t>> wheel;
+	std::vector<uint64_t> fired;
+	uint64_t current; // next tick to be processed
+	size_t   count;
+};
+
+#endif